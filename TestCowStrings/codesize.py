@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+#
+#  Hot-loop code size per String implementation, from a TestCowStrings
+#  binary built with and one built without TEST_COLD_PATHS (see test.cpp):
+#
+#      python codesize.py before.exe after.exe
+#
+#  The hot loop is Test<S> (with TestStep and every String member it calls
+#  inlined into it) for S = <implementation>::String. The cold code is the
+#  out-of-line slow paths of that String: Grow, Unshare, Clone and the deep
+#  copying BasicStringBuf constructor. Disassembles with objdump where it's
+#  on the PATH, else with dumpbin (which needs the .pdb next to the .exe).
+
+import re
+import shutil
+import subprocess
+import sys
+
+COLD_MEMBERS = r'(Grow|Unshare|Clone|BasicStringBuf)'
+
+
+def disassemble(binary):
+    if shutil.which('objdump'):
+        return 'objdump', subprocess.run(['objdump', '-d', '-C', '-w', binary],
+                                         capture_output=True, text=True, check=True).stdout
+    return 'dumpbin', subprocess.run(['dumpbin', '/disasm', binary],
+                                     capture_output=True, text=True, check=True).stdout
+
+
+def functions(tool, text):
+    """Yields (name, bytes, instructions) for every function."""
+    if tool == 'objdump':
+        header = re.compile(r'^[0-9a-f]+ <(.*)>:$')
+        insn   = re.compile(r'^\s+[0-9a-f]+:\t((?:[0-9a-f]{2} )+)\s*(\S.*)?$')
+    else:
+        header = re.compile(r'^(\S.*):$')
+        insn   = re.compile(r'^\s+[0-9A-F]+: ((?:[0-9A-F]{2} )+)\s*(\S.*)?$')
+    name, size, count = None, 0, 0
+    for line in text.splitlines():
+        m = header.match(line)
+        if m:
+            if name:
+                yield name, size, count
+            name, size, count = m.group(1), 0, 0
+            continue
+        m = insn.match(line)
+        if m and name:
+            size += len(m.group(1).split())
+            if m.group(2):           # not just a continuation of the bytes
+                count += 1
+    if name:
+        yield name, size, count
+
+
+def classify(tool, name):
+    """Returns (implementation, 'hot' or 'cold'), or None."""
+    if tool == 'objdump':
+        m = re.match(r'int Test<(\w+)::BasicString<NoInstr> >\(', name)
+        if m:
+            return m.group(1), 'cold' if '.cold' in name else 'hot'
+        m = re.match(r'(\w+)::BasicString(?:Buf)?<NoInstr>::' + COLD_MEMBERS + r'\(', name)
+        if m:
+            return m.group(1), 'cold'
+    else:
+        m = re.match(r'\?\?\$Test@V\?\$BasicString@UNoInstr@@@(\w+)@@', name)
+        if m:
+            return m.group(1), 'hot'
+        m = re.match(r'\?(?:' + COLD_MEMBERS + r'|\?0)@?\?\$BasicString(?:Buf)?@UNoInstr@@@(\w+)@@', name)
+        if m:
+            return m.group(2), 'cold'
+    return None
+
+
+def measure(binary):
+    tool, text = disassemble(binary)
+    sizes = {}
+    for name, size, count in functions(tool, text):
+        c = classify(tool, name)
+        if c:
+            s = sizes.setdefault(c[0], {'hot': [0, 0], 'cold': [0, 0]})
+            s[c[1]][0] += size
+            s[c[1]][1] += count
+    return sizes
+
+
+def main(argv):
+    if len(argv) < 2:
+        print('usage: codesize.py binary [binary...]  (e.g. before.exe after.exe)')
+        return 1
+    runs = [measure(b) for b in argv[1:]]
+    names = sorted(set().union(*runs))
+    print('%-16s' % 'implementation' + ''.join(
+        '  %28s' % ('%s: hot bytes/insns, cold' % ('#%d' % (i + 1))) for i in range(len(runs))))
+    for n in names:
+        row = '%-16s' % n
+        for i, r in enumerate(runs):
+            hot, cold = r.get(n, {}).get('hot', [0, 0]), r.get(n, {}).get('cold', [0, 0])
+            delta = ''
+            if i and runs[0].get(n, {}).get('hot', [0])[0]:
+                delta = ' (%+.0f%%)' % ((hot[0] - runs[0][n]['hot'][0]) * 100.0 / runs[0][n]['hot'][0])
+            row += '  %6d/%5d%-7s %6d/%4d' % (hot[0], hot[1], delta, cold[0], cold[1])
+        print(row)
+    for i, b in enumerate(argv[1:]):
+        print('#%d = %s' % (i + 1, b))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
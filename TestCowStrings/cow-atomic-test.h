@@ -0,0 +1,287 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//------------------------------------------------------------------------------
+//
+//  Here's the code that's the same for COW_AtomicInt2 and the variants built
+//  on its single buffer. #include it inside the namespace, after defining
+//  StringBuf (len, used and refs, of REF_COUNT::Count) and:
+//
+//    REF_COUNT       the reference count policy BasicString gets by default:
+//                    AtomicRefs or MaybeAtomicRefs from test.h, or one of the
+//                    same shape, like COW_Ordered's Orders
+//
+//  and, optionally:
+//
+//    TAGGED_UNIQUE   to keep a "known unique" bit, nUniqueBit, in the low bit
+//                    of the String's pointer to its buffer (COW_TaggedUnique)
+//    CHAR_PTR        for the String to point at the first character, with
+//                    the StringBuf just before it, and to keep the characters
+//                    NUL-terminated for c_str (COW_CharPtr)
+//
+//  Data() is what the String points at, and Set() points it at another
+//  buffer, saying whether it's the only holder. Without TAGGED_UNIQUE that's
+//  never known, and the tests of KnownUnique() compile away. LEN, USED, REFS
+//  and BUF get at the StringBuf fields and the characters from Data(); they
+//  are COW_AtomicInt2's, or COW_CharPtr's with CHAR_PTR.
+//
+//------------------------------------------------------------------------------
+
+#ifdef CHAR_PTR
+    const size_t nDataOffset = sizeof(StringBuf);   // the String points past the header
+    const size_t nTerminator = 1;                   // the NUL after the characters
+#else
+    const size_t nDataOffset = 0;
+    const size_t nTerminator = 0;
+#endif
+
+    template<class I, class R = REF_COUNT>
+    class BasicString {
+    public:
+        BasicString();
+       ~BasicString();
+        BasicString( const BasicString& );
+        BasicString( BasicString&& );  // leaves other fit only to clear or destroy
+        void   Swap( BasicString& ) throw();
+        void   Clear();
+        void   Append( char );
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;     // read-only access, stays shareable
+#ifdef CHAR_PTR
+        const char* c_str() const;
+#endif
+
+        static Stats stats;
+
+    private:
+#ifdef TAGGED_UNIQUE
+        char* Data() const              { return reinterpret_cast<char*>( Bits() & ~nUniqueBit ); }
+        bool  KnownUnique() const       { return ( Bits() & nUniqueBit ) != 0; }
+        void  ClearUnique() const       { bits_.store( Bits() & ~nUniqueBit, memory_order_relaxed ); }
+        void  Set( char* data, bool bUnique ) {
+          bits_.store( reinterpret_cast<size_t>( data ) | ( bUnique ? nUniqueBit : 0 ), memory_order_relaxed );
+        }
+        size_t Bits() const             { return bits_.load( memory_order_relaxed ); }
+#else
+        char* Data() const              { return data_; }
+        bool  KnownUnique() const       { return false; }
+        void  ClearUnique() const       { }
+        void  Set( char* data, bool )   { data_ = data; }
+#endif
+        static char* Alloc( size_t len );
+        static void  Free( char* data );
+        static void  Terminate( char* data ) { if( nTerminator ) { BUF(data)[USED(data)] = '\0'; } }
+        char* Clone( char* olddata, size_t n = 0 );
+        void  Reserve( size_t n );
+        void  Grow( size_t n );
+        void  EnsureUnique( size_t n );
+        void  Unshare( size_t n );
+        void  EnsureUnshareable( size_t n );
+#ifdef TAGGED_UNIQUE
+        mutable atomic<size_t> bits_; // the buffer, | nUniqueBit
+#else
+        char* data_;
+#endif
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I, class R> Stats BasicString<I, R>::stats;
+
+    template<class I, class R>
+    inline BasicString<I, R>::BasicString()
+    {
+      Set( Alloc( 0 ), true );
+    }
+
+    template<class I, class R>
+    inline BasicString<I, R>::~BasicString() {
+      char* data = Data();
+      if( data && ( KnownUnique() || R::Decrement( REFS(data) ) < 1 ) ) {
+        I::OnFree( stats, LEN(data) );
+        Free( data );
+      }
+    }
+
+    template<class I, class R>
+    inline BasicString<I, R>::BasicString( const BasicString& other )
+    {
+      char* data = other.Data();
+      if( R::Shareable( REFS(data) ) ) {
+        R::Increment( REFS(data) );
+        if( other.KnownUnique() ) {
+          other.ClearUnique();
+        }
+        Set( data, false );
+        I::OnShare( stats );
+      }
+      else {
+        Set( Clone( data ), true );
+        I::OnDeepCopy( stats, USED(Data()) );
+      }
+      I::OnCopy( stats );
+    }
+
+    //  Takes over other's reference, so the count doesn't change. Giving
+    //  other an empty buffer of its own would cost the allocation a move is
+    //  there to save, so other is left with none, which only the destructor
+    //  checks for (Clear swaps the null into a temporary and destroys that).
+    //
+    template<class I, class R>
+    inline BasicString<I, R>::BasicString( BasicString&& other )
+    {
+      Set( other.Data(), other.KnownUnique() );
+      other.Set( 0, false );
+      I::OnMove( stats );
+    }
+
+    template<class I, class R>
+    inline void BasicString<I, R>::Swap( BasicString& other ) throw() {
+      char* data    = Data();
+      bool  bUnique = KnownUnique();
+      Set( other.Data(), other.KnownUnique() );
+      other.Set( data, bUnique );
+    }
+
+    template<class I, class R>
+    inline void BasicString<I, R>::Clear() {
+      BasicString tmp;
+      Swap( tmp );
+    }
+
+    template<class I, class R>
+    inline void BasicString<I, R>::Append( char c ) {
+      EnsureUnique( USED(Data())+1 );
+      char* data = Data();
+      BUF(data)[USED(data)++] = c;
+      Terminate( data );
+    }
+
+    template<class I, class R>
+    inline size_t BasicString<I, R>::Length() const {
+      return USED(Data());
+    }
+
+    template<class I, class R>
+    inline char& BasicString<I, R>::operator[]( size_t n ) {
+      EnsureUnshareable( LEN(Data()) );
+      return *(BUF(Data())+n);
+    }
+
+    template<class I, class R>
+    inline char BasicString<I, R>::At( size_t n ) const {
+      return *(BUF(Data())+n);
+    }
+
+#ifdef CHAR_PTR
+    template<class I, class R>
+    inline const char* BasicString<I, R>::c_str() const {
+      return BUF(Data());
+    }
+#endif
+
+    //  Room for the header and len characters, and the NUL with CHAR_PTR.
+    //
+    template<class I, class R>
+    inline char* BasicString<I, R>::Alloc( size_t len ) {
+      I::OnAlloc( stats, sizeof(StringBuf) + len + nTerminator );
+      char* data = NEW_CHARS( sizeof(StringBuf) + len + nTerminator ) + nDataOffset;
+      LEN(data)  = len;
+      USED(data) = 0;
+      R::Init( REFS(data), 1 );
+      Terminate( data );
+      return data;
+    }
+
+    template<class I, class R>
+    inline void BasicString<I, R>::Free( char* data ) {
+      DELETE_CHARS( data - nDataOffset, sizeof(StringBuf) + LEN(data) + nTerminator );
+    }
+
+    //  Copies the characters, not the whole StringBuf, whose refs may be a
+    //  std::atomic.
+    //
+    template<class I, class R>
+    COLD char* BasicString<I, R>::Clone( char* data, size_t n ) {
+      size_t needed = static_cast<size_t>(max(LEN(data)*1.5, static_cast<double>(n)));
+
+      size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
+      char*  newdata = Alloc( newlen );
+      memcpy( BUF(newdata), BUF(data), USED(data) + nTerminator );
+      USED(newdata) = USED(data);
+      return newdata;
+    }
+
+    //  Only ever called by a unique holder.
+    //
+    template<class I, class R>
+    inline void BasicString<I, R>::Reserve( size_t n ) {
+      if( UNLIKELY( LEN(Data()) < n ) ) {
+        Grow( n );
+      }
+    }
+
+    template<class I, class R>
+    COLD void BasicString<I, R>::Grow( size_t n ) {
+      char* data    = Data();
+      char* newdata = Clone( data, n );
+      I::OnGrow( stats, USED(data) );
+      Free( data );
+      Set( newdata, true );
+    }
+
+    //  A String that knows it's the only holder doesn't look at refs, and
+    //  leaves it alone: if it's unshareable, it stays so.
+    //
+    template<class I, class R>
+    inline void BasicString<I, R>::EnsureUnique( size_t n ) {
+      if( LIKELY( KnownUnique() ) ) {
+        Reserve( n );
+        return;
+      }
+      I::OnRefsRead( stats );
+      char* data = Data();
+      if( UNLIKELY( R::Compare( REFS(data), 1 ) > 0 ) ) {
+        Unshare( n );
+      }
+      else {
+        Set( data, true );        // everyone else has let go
+        Reserve( n );
+        R::Set( REFS(Data()), 1 ); // shareable again
+      }
+    }
+
+    template<class I, class R>
+    COLD void BasicString<I, R>::Unshare( size_t n ) {
+      I::OnUnshare( stats );
+      char* data    = Data();
+      char* newdata = Clone( data, n );
+      I::OnDeepCopy( stats, USED(data) );
+      if( R::Decrement( REFS(data) ) < 1 ) {
+        Free( newdata );          // just in case two threads
+        R::Set( REFS(data), 1 );  //  are trying this at once
+        Set( data, true );
+      }
+      else {                      // now all the real work is
+        Set( newdata, true );     //  done, so take ownership
+      }
+    }
+
+    //  refs goes negative, so that copies made from now on are deep.
+    //
+    template<class I, class R>
+    inline void BasicString<I, R>::EnsureUnshareable( size_t n ) {
+      EnsureUnique( n );
+      R::Set( REFS(Data()), -1 );
+      I::OnUnshareable( stats );
+    }
@@ -0,0 +1,79 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//------------------------------------------------------------------------------
+//
+//  Here's the code that's the same for the lock-based COW versions, from
+//  COW_CritSec and COW_Mutex on, that use one of the Lock<T>-compatible locks
+//  in test.h, with the lock type left open. #include it after common-test.h,
+//  with LOCK_TYPE defined and BAGGAGE defined as "LOCK_TYPE lk".
+//
+//------------------------------------------------------------------------------
+
+    template<class I>
+    inline BasicString<I>::~BasicString() {
+      bool bDelete = false;
+      Lock<LOCK_TYPE> l(data_->lk); //---------------
+      if( --data_->refs < 1 ) {
+        bDelete = true;
+      }
+      l.Unlock(); //---------------------------------
+      if( bDelete ) {
+        delete data_;
+      }
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+    {
+      Lock<LOCK_TYPE> l(other.data_->lk); //---------
+      if( other.data_->refs > 0 ) {
+        data_ = other.data_;
+        ++data_->refs;
+        I::OnShare( stats );
+        l.Unlock(); //-------------------------------
+      }
+      else {
+        l.Unlock(); //-------------------------------
+        data_ = new StringBuf( *other.data_ );
+      }
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      Lock<LOCK_TYPE> l(data_->lk); //---------------
+      if( data_->refs > 1 ) {
+        --data_->refs;
+        l.Unlock(); //-------------------------------
+        data_ = new StringBuf;
+      } else {
+        l.Unlock(); //-------------------------------
+        data_->Clear();
+        data_->refs = 1; // shareable again
+      }
+    }
+
+    template<class I>
+    inline void BasicString<I>::EnsureUnique( size_t n ) {
+      I::OnRefsRead( stats );
+      Lock<LOCK_TYPE> l(data_->lk); //---------------
+      if( UNLIKELY( data_->refs > 1 ) ) {
+        I::OnUnshare( stats );
+        StringBuf* newdata = new StringBuf( *data_, n );
+        --data_->refs;
+        l.Unlock(); //-------------------------------
+        data_ = newdata;
+      }
+      else {
+        l.Unlock(); //-------------------------------
+        data_->Reserve( n );
+        data_->refs = 1; // shareable again
+      }
+    }
@@ -0,0 +1,210 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//------------------------------------------------------------------------------
+//
+//  Here's the code that's the same for the shared_ptr<const std::string>
+//  versions: copies share the std::string, and a mutator that isn't the only
+//  owner (use_count() > 1) first copies it into a new one of its own. An
+//  empty String holds no string at all. #include it with MAKE_STRING( x )
+//  defined to make a shared_ptr<string> holding a copy of the std::string x.
+//
+//  The strings are only const through the shared_ptr: MAKE_STRING makes a
+//  non-const one, so that a sole owner may cast the const away and write to
+//  it in place. As with the GotW COW strings, a String that has handed out a
+//  writable reference with operator[] is unshareable: its copies get a deep
+//  copy, until it's cleared.
+//
+//  SharedString is what TestSharedReaders' threads share: a shared_ptr that
+//  is only ever loaded and stored atomically (see ReadShared and WriteShared).
+//  It's a std::atomic<shared_ptr> where the library has one (C++20, which
+//  deprecates the free atomic_load and atomic_store on a plain shared_ptr),
+//  and a shared_ptr used through those free functions before that.
+//
+//  *** NOTE: Only copies, moves, shares, deep copies and unshares are counted;
+//            std::string's own allocations aren't visible from here
+//
+//------------------------------------------------------------------------------
+
+    template<class I> class SharedString;
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();
+       ~BasicString();
+        BasicString( const BasicString& );
+        BasicString( BasicString&& );          // leaves other empty
+        void   Clear();
+        void   Append( char );
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;     // read-only access, stays shareable;
+                                     //  n < Length(), so never on an empty
+                                     //  String, which may hold no string
+
+        typedef SharedString<I> Shared;
+
+        static Stats stats;
+    private:
+        friend class SharedString<I>;
+        void EnsureUnique();
+        shared_ptr<const string> p_;
+        bool                     bUnshareable_;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    template<class I>
+    inline BasicString<I>::BasicString() : bUnshareable_(false) { }
+
+    template<class I>
+    inline BasicString<I>::~BasicString() { }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+      : bUnshareable_(false)
+    {
+      if( !other.bUnshareable_ ) {
+        p_ = other.p_;
+        I::OnShare( stats );
+      }
+      else {
+        I::OnAlloc( stats, sizeof(string) );
+        p_ = MAKE_STRING( *other.p_ );
+        I::OnDeepCopy( stats, p_->size() );
+      }
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( BasicString&& other )
+      : p_(std::move(other.p_)),
+        bUnshareable_(other.bUnshareable_)
+    {
+      other.bUnshareable_ = false;
+      I::OnMove( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      p_.reset();
+      bUnshareable_ = false;
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+      EnsureUnique();
+      const_cast<string&>( *p_ ) += c;
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return p_ ? p_->size() : 0;
+    }
+
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      EnsureUnique();
+      bUnshareable_ = true;
+      I::OnUnshareable( stats );
+      return const_cast<string&>( *p_ )[n];
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      return (*p_)[n];
+    }
+
+    //  Nobody else can take a new reference to p_'s string while this holds
+    //  the only one, so use_count() == 1 stays true until this lets go.
+    //
+    template<class I>
+    inline void BasicString<I>::EnsureUnique() {
+      I::OnRefsRead( stats );
+      if( !p_ ) {
+        I::OnAlloc( stats, sizeof(string) );
+        p_ = MAKE_STRING( string() );
+      }
+      else if( UNLIKELY( p_.use_count() > 1 ) ) {
+        I::OnUnshare( stats );
+        I::OnAlloc( stats, sizeof(string) );
+        p_ = MAKE_STRING( *p_ );
+        I::OnDeepCopy( stats, p_->size() );
+      }
+      else {
+        //  use_count() is a relaxed load, so order the writes that follow
+        //  after the reads the other owners made before they let go (their
+        //  releasing decrements).
+        atomic_thread_fence( memory_order_acquire );
+      }
+    }
+
+    template<class I>
+    class SharedString {
+    public:
+        BasicString<I> Load() const {
+          BasicString<I> snap;
+#if __cpp_lib_atomic_shared_ptr
+          snap.p_ = p_.load();
+#else
+          snap.p_ = atomic_load( &p_ );
+#endif
+          I::OnShare( BasicString<I>::stats );
+          I::OnCopy( BasicString<I>::stats );
+          return snap;
+        }
+
+        void Store( const BasicString<I>& s ) {
+#if __cpp_lib_atomic_shared_ptr
+          p_.store( s.p_ );
+#else
+          atomic_store( &p_, s.p_ );
+#endif
+        }
+
+    private:
+#if __cpp_lib_atomic_shared_ptr
+        atomic<shared_ptr<const string> > p_;
+#else
+        shared_ptr<const string>          p_;
+#endif
+    };
+
+    template<class I>
+    inline long ReadShared( SharedString<I>& shared, CriticalSection&, char*, size_t )
+    {
+      BasicString<I> snap( shared.Load() );
+
+      long sum = 0;
+      for( size_t i = 0, len = snap.Length(); i < len; ++i )
+      {
+          sum += snap.At( i );
+      }
+      return sum;
+    }
+
+    //  The new string is built privately, then swapped in: readers see
+    //  either the old one or the new one, like a configuration reload.
+    //
+    template<class I>
+    inline void WriteShared( SharedString<I>& shared, CriticalSection&, const char* p, size_t n )
+    {
+      BasicString<I> next;
+      for( size_t i = 0; i < n; ++i )
+      {
+          next.Append( p[i] );
+      }
+      shared.Store( next );
+    }
@@ -0,0 +1,65 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//  This has to come before any standard header: it picks which std::string
+//  the whole translation unit gets (see stdstring-cow.h).
+//
+#define _GLIBCXX_USE_CXX11_ABI 0
+
+#include <string>
+#include <new>
+#include "stdstring-cow.h"
+
+#if defined __GLIBCXX__
+
+  namespace {
+
+    //  The old std::string is a single pointer into its reference-counted
+    //  rep, so it's built in place in StdCowString's rep_.
+    //
+    static_assert( sizeof(std::string) == sizeof(void*), "not the COW std::string" );
+
+    inline std::string&       S( void*& p )       { return *reinterpret_cast<std::string*>( &p ); }
+    inline const std::string& S( void* const& p ) { return *reinterpret_cast<const std::string*>( &p ); }
+
+  }
+
+  StdCowString::StdCowString() {
+    new( &rep_ ) std::string;
+  }
+
+  StdCowString::~StdCowString() {
+    S( rep_ ).~basic_string();
+  }
+
+  StdCowString::StdCowString( const StdCowString& other ) {
+    new( &rep_ ) std::string( S( other.rep_ ) );
+  }
+
+  void StdCowString::Clear() {
+    S( rep_ ).clear();
+  }
+
+  void StdCowString::Append( char c ) {
+    S( rep_ ) += c;
+  }
+
+  size_t StdCowString::Length() const {
+    return S( rep_ ).size();
+  }
+
+  char& StdCowString::operator[]( size_t n ) {
+    return S( rep_ )[n];
+  }
+
+  char StdCowString::At( size_t n ) const {
+    return S( rep_ )[n];
+  }
+
+#endif
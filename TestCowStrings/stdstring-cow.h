@@ -0,0 +1,46 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//==============================================================================
+//
+//  StdCowString: libstdc++'s pre-C++11 reference-counted std::string, which
+//  is what std::string still is in a translation unit built with
+//  _GLIBCXX_USE_CXX11_ABI=0. A translation unit can only see one of the two
+//  std::strings, so the old one lives in stdstring-cow.cpp behind this
+//  wrapper, and test.cpp only ever sees the one pointer it holds.
+//
+//  Only for libstdc++ (__GLIBCXX__). The members are out of line, but most
+//  of the old string's own members are out of line too: libstdc++ builds
+//  them into the library (extern template), so a call per op was there
+//  already.
+//
+//==============================================================================
+
+#ifndef STDSTRING_COW_H
+#define STDSTRING_COW_H
+
+#include <cstddef>
+
+class StdCowString {
+public:
+    StdCowString();
+   ~StdCowString();
+    StdCowString( const StdCowString& );     // shares, as the old std::string does
+    void   Clear();
+    void   Append( char );
+    size_t Length() const;
+    char&  operator[](size_t);                // unshares, and leaks the buffer
+    char   At(size_t) const;                  // read-only, stays shared
+
+private:
+    StdCowString& operator=( const StdCowString& );
+    void* rep_;                               // a std::string, old ABI
+};
+
+#endif // STDSTRING_COW_H
@@ -1,1127 +1,5065 @@
-////////////////////////////////////////////////////////////////////////////////
-//
-// String Performance Tests Based on Herb Sutter's GotW #45.
-//
-// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
-//
-////////////////////////////////////////////////////////////////////////////////
-
-
-//==============================================================================
-//
-//  Guru of the Week #45: Sample code, and performance test harness.
-//
-//  Version 2.0: Changes include the following:
-//
-//      - changed reference count from unsigned to long, and "unshareable"
-//          state is now flagged by a negative number
-//
-//      - changed IntAtomicGet to IntAtomicCompare
-//
-//      - inlined everything
-//
-//      - changed AboutToModify to EnsureUnique and EnsureUnshareable, in order
-//          to avoid passing the "bMarkUnshareable" bool as a runtime flag when
-//          this is after all known at compile time
-//
-//      - created fixed-size allocator (i.e., "fast allocator") for StringBuf
-//          to eliminate any issues related to double allocation penalties
-//
-//      - added alternatively-optimized COW test cases, include COW_AtomicInt2
-//          that avoids a secondary allocation by using a single buffer for the
-//          len/used/refs values and the string data
-//
-//      - added non-COW test cases, including one that uses a fast allocator
-//          (the original version compared only various thread-safe and -unsafe
-//          flavours of COW, and didn't compare plain non-COW)
-//
-//      - added native x86 assembler versions of the AtomicInt functions to
-//          show that the Win32 operations were equally efficient (no, there's
-//          no function-call overhead)
-//
-//      - added ability to test copying and Append, in addition to operator[],
-//          which also meant adding a function to shrink a string
-//
-//      - changed from calling copy to calling memcpy... on my compiler,
-//          memcpy was about three times faster (indicating that perhaps this
-//          implementation ought to specialize copy for builtin types), and
-//          the majority of COW's performance advantage came from avoiding the
-//          inefficient copy, not from avoiding the allocation
-//
-//      - a lot of miscellaneous things I probably forgot to document
-//
-//  Copyright (c) 1998 by H.P.Sutter. All rights reserved. You may download and
-//  compile and play with this code to your heart's content, but you may not
-//  redistribute it; instead, please just include a link to this code at the
-//  official GotW site.
-//
-//==============================================================================
-
-#include <iostream>
-#include <fstream>
-#include <iomanip>
-#include <limits>
-#include <algorithm>
-#include <string>
-#include <atlstr.h>
-using namespace std;
-
-//  Test.H contains sample definitions for CriticalSection, Mutex, IntAtomicXxx,
-//  FastArena, and Timer. You will need to supply your own definitions here;
-//  these classes are highly operating system-specific.
-//
-#include "test.h"   // *** you must implement this yourself ***
-
-
-
-//--- Uncomment exactly one #define corresponding to the test you wish you run,
-//    then rebuild and run (using command-line parameters to vary the number
-//    of iterations, etc.).
-
-//#define TEST_CONST_COPY       1
-//#define TEST_APPEND           1
-//#define TEST_OPERATOR         1
-
-//#define TEST_INT_OPS_ONLY     1
-
-#define TEST_MUTATING_COPY_2A 1
-//#define TEST_MUTATING_COPY_2B 1
-
-
-
-//------------------------------------------------------------------------------
-//
-//  Non-COW: Here's the original unoptimized version from GotW #43,
-//  plus Length() and operator[]() functions.
-//
-//------------------------------------------------------------------------------
-
-  namespace Plain {
-
-    class String {
-    public:
-        String();                // start off empty
-       ~String();                // free the buffer
-        String( const String& ); // take a full copy
-        void Clear();
-        void Append( char );     // append one character
-        size_t Length() const;
-        char&  operator[](size_t);
-
-        static int nCopies;
-        static int nAllocs;
-    private:
-        void Reserve( size_t );
-        char*    buf_;           // allocated buffer
-        size_t   len_;           // length of buffer
-        size_t   used_;          // # chars actually used
-    };
-
-    int String::nCopies;
-    int String::nAllocs;
-
-    String::String() : buf_(0), len_(0), used_(0) { }
-
-    String::~String() { delete[] buf_; }
-
-    String::String( const String& other )
-    : buf_(new char[other.len_]),
-      len_(other.len_),
-      used_(other.used_)
-    {
-      memcpy( buf_, other.buf_, used_ );
-      ++nCopies;
-      ++nAllocs;
-    }
-
-    inline void String::Clear() {
-      delete[] buf_;
-      buf_ = 0;
-      len_ = 0;
-      used_ = 0;
-    }
-
-    inline void String::Reserve( size_t n ) {
-      if( len_ < n ) {
-        size_t needed = static_cast<size_t>(max(len_*1.5, static_cast<double>(n)));
-
-        size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
-        char*  newbuf = newlen ? (++nAllocs, new char[ newlen ]) : 0;
-        if( buf_ )
-        {
-            memcpy( newbuf, buf_, used_ );
-        }
-
-        delete[] buf_;  // now all the real work is
-        buf_ = newbuf;  //  done, so take ownership
-        len_ = newlen;
-      }
-    }
-
-    inline void String::Append( char c ) {
-      Reserve( used_+1 );
-      buf_[used_++] = c;
-    }
-
-    inline size_t String::Length() const {
-      return used_;
-    }
-
-    inline char& String::operator[]( size_t n ) {
-      return *(buf_+n);
-    }
-
-  }
-
-
-
-
-
-//------------------------------------------------------------------------------
-//
-// std::string
-//
-//------------------------------------------------------------------------------
-
-  namespace StdString {
-
-    class String {
-    public:
-        String();                // start off empty
-       ~String();                // free the buffer
-        String( const String& ); // take a full copy
-        void Clear();
-        void Append( char );     // append one character
-        size_t Length() const;
-        char&  operator[](size_t);
-
-        // *** NOTE: Meaningless for std::string
-        static int nCopies;
-        static int nAllocs;
-    private:
-        std::string _s;
-    };
-
-    int String::nCopies;
-    int String::nAllocs;
-
-    String::String() { }
-
-    String::~String() { }
-
-    String::String( const String& other )
-    : _s(other._s)
-    {
-    }
-
-    inline void String::Clear() {
-        _s.clear();
-    }
-
-    inline void String::Append( char c ) {
-        _s += c;
-    }
-
-    inline size_t String::Length() const {
-      return _s.size();
-    }
-
-    inline char& String::operator[]( size_t n ) {
-      return _s[n];
-    }
-
-  }
-
-
-  
-//------------------------------------------------------------------------------
-//
-// ATL CStringA
-//
-//------------------------------------------------------------------------------
-
-  namespace AtlString {
-
-    class String {
-    public:
-        String();                // start off empty
-       ~String();                // free the buffer
-        String( const String& ); // take a full copy
-        void Clear();
-        void Append( char );     // append one character
-        size_t Length() const;
-        char  operator[](size_t) const; // char& not possible on CString
-
-        // *** NOTE: Meaningless for CString
-        static int nCopies;
-        static int nAllocs;
-    private:
-        ATL::CStringA _s;
-    };
-
-    int String::nCopies;
-    int String::nAllocs;
-
-    String::String() { }
-
-    String::~String() { }
-
-    String::String( const String& other )
-    : _s(other._s)
-    {
-    }
-
-    inline void String::Clear() {
-        _s.Empty();
-    }
-
-    inline void String::Append( char c ) {
-        _s += c;
-    }
-
-    inline size_t String::Length() const {
-      return _s.GetLength();
-    }
-
-    inline char String::operator[]( size_t n ) const {
-      return _s.GetAt(static_cast<int>(n));
-    }
-
-  }
-
-
-
-
-
-//------------------------------------------------------------------------------
-//
-//  Non-COW: Same as above, but optimized to use a more efficient allocator
-//  instead of the built-in library allocator.
-//
-//------------------------------------------------------------------------------
-
-  namespace Plain_FastAlloc {
-
-    class String {
-    public:
-        String();                // start off empty
-       ~String();                // free the buffer
-        String( const String& ); // take a full copy
-        void Clear();
-        void Append( char );     // append one character
-        size_t Length() const;
-        char&  operator[](size_t);
-
-        static int nCopies;
-        static int nAllocs;
-    private:
-        void Reserve( size_t );
-        char*    buf_;           // allocated buffer
-        size_t   len_;           // length of buffer
-        size_t   used_;          // # chars actually used
-        static FastArena fa;
-    };
-
-    int String::nCopies;
-    int String::nAllocs;
-    FastArena String::fa( "Plain_FastAlloc" );
-
-    String::String() : buf_(0), len_(0), used_(0) { }
-
-    String::~String() { fa.Deallocate(buf_); }
-
-    String::String( const String& other )
-    : buf_((char*)fa.Allocate(other.len_)),
-      len_(other.len_),
-      used_(other.used_)
-    {
-      memcpy( buf_, other.buf_, used_ );
-      ++nCopies;
-      ++nAllocs;
-    }
-
-    inline void String::Clear() {
-      fa.Deallocate(buf_);
-      buf_ = 0;
-      len_ = 0;
-      used_ = 0;
-    }
-
-    inline void String::Reserve( size_t n ) {
-      if( len_ < n ) {
-        size_t needed = static_cast<size_t>(max(len_*1.5, static_cast<double>(n)));
-
-        size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
-        char*  newbuf = newlen ? (++nAllocs, (char*)fa.Allocate(newlen)) : 0;
-        if( buf_ )
-        {
-            memcpy( newbuf, buf_, used_ );
-        }
-
-        fa.Deallocate(buf_); // now all the real work is
-        buf_ = newbuf;       //  done, so take ownership
-        len_ = newlen;
-      }
-    }
-
-    inline void String::Append( char c ) {
-      Reserve( used_+1 );
-      buf_[used_++] = c;
-    }
-
-    inline size_t String::Length() const {
-      return used_;
-    }
-
-    inline char& String::operator[]( size_t n ) {
-      return *(buf_+n);
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  COW: Initial thread-unsafe implementation.
-//
-//==============================================================================
-
-  namespace COW_Unsafe {
-
-    #undef  NAME
-    #undef  BAGGAGE
-    #define NAME    "COW_Unsafe"
-    #define BAGGAGE
-    #include "common-test.h" //****************************************************
-
-    inline String::~String() {
-      if( --data_->refs < 1 ) {
-        delete data_;
-      }
-    }
-
-    inline String::String( const String& other )
-    {
-      if( other.data_->refs > 0 ) {
-        data_ = other.data_;
-        ++data_->refs;
-      } else {
-        data_ = new StringBuf( *other.data_ );
-      }
-      ++nCopies;
-    }
-
-    inline void String::Clear() {
-      if( data_->refs > 1 ) {
-        --data_->refs;
-        data_ = new StringBuf;
-      } else {
-        data_->Clear();
-        data_->refs = 1; // shareable again
-      }
-    }
-
-    inline void String::EnsureUnique( size_t n ) {
-      if( data_->refs > 1 ) {
-        StringBuf* newdata = new StringBuf( *data_, n );
-        --data_->refs;   // now all the real work is
-        data_ = newdata; //  done, so take ownership
-      } else {
-        data_->Reserve( n );
-        data_->refs = 1; // shareable again
-      }
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  COW: Safe implementation, using atomic integer manipulation functions.
-//
-//==============================================================================
-
-  namespace COW_AtomicInt {
-
-    #undef  NAME
-    #undef  BAGGAGE
-    #define NAME    "COW_AtomicInt"
-    #define BAGGAGE
-    #include "common-test.h" //****************************************************
-
-    inline String::~String() {
-      if( IntAtomicDecrement( data_->refs ) < 1 ) {
-        delete data_;
-      }
-    }
-
-    inline String::String( const String& other )
-    {
-      if( IntAtomicCompare( other.data_->refs, 0 ) > 0 ) {
-        data_ = other.data_;
-        IntAtomicIncrement( data_->refs );
-      }
-      else {
-        data_ = new StringBuf( *other.data_ );
-      }
-      ++nCopies;
-    }
-
-    inline void String::Clear() {
-      if( IntAtomicDecrement( data_->refs ) < 1 ) {
-        data_->Clear();  // also covers case where two
-        data_->refs = 1; //  threads are trying this at once
-      }
-      else {
-        data_ = new StringBuf;
-      }
-    }
-
-    inline void String::EnsureUnique( size_t n ) {
-      if( IntAtomicCompare( data_->refs, 1 ) > 0 ) {
-        StringBuf* newdata = new StringBuf( *data_, n );
-        if( IntAtomicDecrement( data_->refs ) < 1 ) {
-          delete newdata;  // just in case two threads
-          data_->refs = 1; //  are trying this at once
-        }
-        else {             // now all the real work is
-          data_ = newdata; //  done, so take ownership
-        }
-      }
-      else {
-        data_->Reserve( n );
-        data_->refs = 1; // shareable again
-      }
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  COW: Safe implementation, using atomic integer manipulation functions.
-//       AND a single buffer containing both the StringBuf control data.
-//
-//       The only thing I'm not doing is optimizing the empty-string case,
-//       because if I did that here I should also do it in the Plain case.
-//       Since all implementations are doing it the same way (not optimizing
-//       the empty-string case), they can be meaningfully compared. Besides,
-//       the more you optimize the more complicated it gets.
-//
-//       MORAL: Never start optimizing before you: a) know you need to;
-//              and b) know that you actually are!
-//
-//==============================================================================
-
-  namespace COW_AtomicInt2 {
-
-    //  The layout of the StringBuf object sits in the initial bytes of a
-    //  dynamically-allocated char buffer of length sizeof(StringBuf)+len.
-    //  If you want to change this "glommed" buffer's size, you have to make a
-    //  new one... hence Reserve is no longer a member of StringBuf.
-    //
-    struct StringBuf {
-        size_t   len;
-        size_t   used;
-        long     refs;
-    };
-
-    class String {
-    public:
-        String();
-       ~String();
-        String( const String& );
-        void   Swap( String& ) throw();
-        void   Clear();
-        void   Append( char );
-        size_t Length() const;
-        char&  operator[](size_t);
-
-        static int nCopies;
-        static int nAllocs;
-
-    private:
-        char* Clone( char* olddata, size_t n = 0 );
-        void  Reserve( size_t n );
-        void  EnsureUnique( size_t n );
-        void  EnsureUnshareable( size_t n );
-        char* data_;
-    };
-
-    int String::nCopies;
-    int String::nAllocs;
-
-    #define LEN(x)   (((StringBuf*)(x))->len)
-    #define USED(x)  (((StringBuf*)(x))->used)
-    #define REFS(x)  (((StringBuf*)(x))->refs)
-    #define BUF(x)   ((x) + sizeof(StringBuf))
-
-    inline String::String()
-      : data_( new char[ sizeof(StringBuf) ] )
-    {
-      ++nAllocs;
-      LEN(data_)  = 0;
-      USED(data_) = 0;
-      REFS(data_) = 1;
-    }
-
-    inline String::~String() {
-      if( IntAtomicDecrement( REFS(data_) ) < 1 ) {
-        delete[] data_;
-      }
-    }
-
-    inline String::String( const String& other )
-    {
-      if( IntAtomicCompare( REFS(other.data_), 0 ) > 0 ) {
-        data_ = other.data_;
-        IntAtomicIncrement( REFS(data_) );
-      }
-      else {
-        data_ = Clone( other.data_ );
-      }
-      ++nCopies;
-    }
-
-    inline void String::Swap( String& other ) throw() {
-      swap( data_, other.data_ );
-    }
-
-    inline void String::Clear() {
-      String tmp;
-      Swap( tmp );
-    }
-
-    inline void String::Append( char c ) {
-      EnsureUnique( USED(data_)+1 );
-      BUF(data_)[USED(data_)++] = c;
-    }
-
-    inline size_t String::Length() const {
-      return USED(data_);
-    }
-
-    inline char& String::operator[]( size_t n ) {
-      EnsureUnshareable( LEN(data_) );
-      return *(BUF(data_)+n);
-    }
-
-    inline char* String::Clone( char* data, size_t n ) {
-      size_t needed = static_cast<size_t>(max(LEN(data)*1.5, static_cast<double>(n)));
-
-      size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
-      char*  newdata = ( ++nAllocs, new char[ sizeof(StringBuf) + newlen ] );
-      memcpy( newdata, data, sizeof(StringBuf)+USED(data) );
-      LEN(newdata)  = newlen;
-      REFS(newdata) = 1;
-      return newdata;
-    }
-
-    inline void String::Reserve( size_t n ) {
-      if( LEN(data_) < n ) {
-        char* newdata = Clone( data_, n );
-        delete[] data_;
-        data_ = newdata;
-      }
-    }
-
-    inline void String::EnsureUnique( size_t n ) {
-      if( IntAtomicCompare( REFS(data_), 1 ) > 0 ) {
-        char* newdata = Clone( data_, n );
-        if( IntAtomicDecrement( REFS(data_) ) < 1 ) {
-          delete[] newdata; // just in case two threads
-          REFS(data_) = 1;  //  are trying this at once
-        }
-        else {              // now all the real work is
-          data_ = newdata;  //  done, so take ownership
-        }
-      }
-      else {
-        Reserve( n );
-        REFS(data_) = 1; // shareable again
-      }
-    }
-
-    inline void String::EnsureUnshareable( size_t n ) {
-      EnsureUnique( n );
-      REFS(data_) = -1;
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  COW: Safe implementation, using a critical section.
-//
-//==============================================================================
-
-  namespace COW_CritSec {
-
-    #undef  NAME
-    #undef  BAGGAGE
-    #define NAME    "COW_CritSec"
-    #define BAGGAGE CriticalSection cs
-    #include "common-test.h" //****************************************************
-
-    inline String::~String() {
-      bool bDelete = false;
-      Lock<CriticalSection> l(data_->cs); //---------
-      if( --data_->refs < 1 ) {
-        bDelete = true;
-      }
-      l.Unlock(); //---------------------------------
-      if( bDelete ) {
-        delete data_;
-      }
-    }
-
-    inline String::String( const String& other )
-    {
-      Lock<CriticalSection> l(other.data_->cs); //---
-      if( other.data_->refs > 0 ) {
-        data_ = other.data_;
-        ++data_->refs;
-        l.Unlock(); //-------------------------------
-      }
-      else {
-        l.Unlock(); //-------------------------------
-        data_ = new StringBuf( *other.data_ );
-      }
-      ++nCopies;
-    }
-
-    inline void String::Clear() {
-      Lock<CriticalSection> l(data_->cs); //---------
-      if( data_->refs > 1 ) {
-        --data_->refs;
-        l.Unlock(); //-------------------------------
-        data_ = new StringBuf;
-      } else {
-        l.Unlock(); //-------------------------------
-        data_->Clear();
-        data_->refs = 1; // shareable again
-      }
-    }
-
-    inline void String::EnsureUnique( size_t n ) {
-      Lock<CriticalSection> l(data_->cs); //---------
-      if( data_->refs > 1 ) {
-        StringBuf* newdata = new StringBuf( *data_, n );
-        --data_->refs;
-        l.Unlock(); //-------------------------------
-        data_ = newdata;
-      }
-      else {
-        l.Unlock(); //-------------------------------
-        data_->Reserve( n );
-        data_->refs = 1; // shareable again
-      }
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  COW: Safe implementation, using a mutex.
-//
-//==============================================================================
-
-  namespace COW_Mutex {
-
-    #undef  NAME
-    #undef  BAGGAGE
-    #define NAME    "COW_Mutex"
-    #define BAGGAGE Mutex m
-    #include "common-test.h" //****************************************************
-
-    inline String::~String() {
-      bool bDelete = false;
-      Lock<Mutex> l(data_->m); //-------------------
-      if( --data_->refs < 1 ) {
-        bDelete = true;
-      }
-      l.Unlock(); //--------------------------------
-      if( bDelete ) {
-        delete data_;
-      }
-    }
-
-    inline String::String( const String& other )
-    {
-      Lock<Mutex> l(other.data_->m); //-------------
-      if( other.data_->refs > 0 ) {
-        data_ = other.data_;
-        ++data_->refs;
-        l.Unlock(); //------------------------------
-      }
-      else {
-        l.Unlock(); //------------------------------
-        data_ = new StringBuf( *other.data_ );
-      }
-      ++nCopies;
-    }
-
-    inline void String::Clear() {
-      Lock<Mutex> l(data_->m); //-------------------
-      if( data_->refs > 1 ) {
-        --data_->refs;
-        l.Unlock(); //------------------------------
-        data_ = new StringBuf;
-      }
-      else {
-        l.Unlock(); //------------------------------
-        data_->Clear();
-        data_->refs = 1; // shareable again
-      }
-    }
-
-    inline void String::EnsureUnique( size_t n ) {
-      Lock<Mutex> l(data_->m); //-------------------
-      if( data_->refs > 1 ) {
-        StringBuf* newdata = new StringBuf( *data_, n );
-        --data_->refs;
-        l.Unlock(); //------------------------------
-        data_ = newdata;
-      }
-      else {
-        l.Unlock(); //------------------------------
-        data_->Reserve( n );
-        data_->refs = 1; // shareable again
-      }
-    }
-
-  }
-
-
-//==============================================================================
-//
-//  Test harness.
-//
-//==============================================================================
-
-ofstream out( "test.out" ); // to ensure there's a 'counter' side-effect
-
-template<class S>
-int Test( S& s, long n, long l )
-{
-    long i = 0, counter = 0;
-    for( i = 0; i < l; ++i )    // initialize s to length l (for copying tests)
-    {
-        s.Append( 'X' );
-    }
-
-    S::nAllocs = 0;
-    S::nCopies = 0;
-
-    n /= 25;    // the inner loop has 25 cycles per outer loop, so this will
-                //  give us the right number of iterations.
-    Timer t;    // *** start timing
-
-    for( i = 0; i < n; ++i )
-    {
-        for( char c = 'a'; c <= 'y'; ++c )
-        {
-#if defined TEST_CONST_COPY
-            //  Simple const copy (cost: copy + destruct)
-            S s2( s );
-#elif defined TEST_APPEND
-            //  Simple appending
-            if( s.Length() > static_cast<size_t>(l) )
-            {
-                s.Clear();
-            }
-            s.Append( c );
-#elif defined TEST_OPERATOR
-            //  Simple nonmutating access
-            counter += s[0];
-#elif defined TEST_MUTATING_COPY_2A
-            //  33% of copies are const (cost: copy ctor + dtor),
-            //  rest are modified once (cost: copy ctor + deep copy +
-            //                                Append/op[] + dtor)
-            S s2( s );
-            if( i % 3 == 0 ) {
-              counter += s2[0];
-            }
-            else if( i % 3 == 1 ) {
-              s2.Append( c );
-            }
-#elif defined TEST_MUTATING_COPY_2B
-            //  50% of copies are const (cost: copy ctor + dtor),
-            //  rest are modified thrice (cost: copy ctor + deep copy +
-            //                                  3*Append/op[] + dtor)
-            S s2( s );
-            if( i % 4 == 0 ) {
-              counter += s2[0];
-              counter += s2[1];
-              counter += s2[2];
-            }
-            else if( i % 4 == 1 ) {
-              s2.Append( c );
-              s2.Append( c );
-              s2.Append( c );
-            }
-#endif
-        }
-    }
-
-    int ret = t.Elapsed();
-    out << "counter = " << counter << endl; // don't let the compiler optimize
-                                            // away op[] and ruin our test case
-
-    return ret;
-}
-
-
-#if defined TEST_INT_OPS_ONLY
-
-#pragma optimize( "g", off )    // the integer loop tests aren't useful with
-                                // optimizations on, because the whole first
-                                // loop will just get optimized away... we
-                                // don't want that, we really want to measure
-                                // how long it takes to increment an int!
-void TestPlainIntOps( long n, long l )
-{
-    // -- NOTE: This test is not meaningful unless compiled with
-    //          optimizations disabled. See the pragma above, or
-    //          change /Ox to /Od in Build.BAT.
-    {
-      long counter = 0;
-      Timer t;
-      while( counter < l )
-      {
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-        ++counter;
-      }
-      cout << "  " << setw(15) << "++plain" << setw(7)
-           << t.Elapsed() << "ms, counter=" << counter << endl;
-    }
-    {
-      long counter = l;
-      Timer t;
-      while( counter > 0 )
-      {
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-        --counter;
-      }
-      cout << "  " << setw(15) << "--plain" << setw(7)
-           << t.Elapsed() << "ms, counter=" << counter << endl;
-    }
-}
-#pragma optimize( "", on )      // reset optimizations to original values
-
-void TestIntOps( long n, long l )
-{
-    for( int j = 0; j < n; ++j )
-    {
-      int nPlain = 0;
-      {
-        TestPlainIntOps( n, l );
-      }
-      cout << endl;
-
-      {
-        volatile long counter = 0;
-        Timer t;
-        while( counter < l )
-        {
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-          ++counter;
-        }
-        cout << "  " << setw(15) << "++volatile" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      {
-        volatile long counter = l;
-        Timer t;
-        while( counter > 0 )
-        {
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-          --counter;
-        }
-        cout << "  " << setw(15) << "--volatile" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      cout << endl;
-
-      {
-        long counter = 0;
-        Timer t;
-        while( counter < l )
-        {
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-          IntAtomicIncrement(counter);
-        }
-        cout << "  " << setw(15) << "++atomic" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      {
-        long counter = l;
-        Timer t;
-        while( counter > 0 )
-        {
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicDecrement(counter);
-          IntAtomicIncrement(counter);
-        }
-        cout << "  " << setw(15) << "--atomic" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      cout << endl;
-
-      {
-        long counter = 0;
-        Timer t;
-        while( counter < l )
-        {
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-          IntAtomicIncrementAss(counter);
-        }
-        cout << "  " << setw(15) << "++atomic_ass" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      {
-        long counter = l, result = 0;
-        Timer t;
-        while( counter > 0 )
-        {
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-          IntAtomicDecrementAss(counter, result);
-        }
-        cout << "  " << setw(15) << "--atomic_ass" << setw(7)
-             << t.Elapsed() << "ms, counter=" << counter << endl;
-      }
-      cout << endl;
-    }
-}
-
-#endif
-
-int main( int argc, char* argv[] )
-{
-    long nRuns = 2, nLoops = 1000 * 1000, nLen = 100;
-
-    if( argc > 1)
-    {
-        nRuns = atol( argv[1] );
-    }
-    if( argc > 2)
-    {
-        nLoops = atol( argv[2] );
-    }
-    if( argc > 3)
-    {
-        nLen = atol( argv[3] );
-    }
-
-    cout << "Preparing for clean timing runs... ";
-    Sleep( 1000 );
-    Plain::String throwawayString;
-    Test( throwawayString, 10000, 10 ); // throwaway work
-
-#if !defined TEST_INT_OPS_ONLY
-
-    cout << "done.\nRunning " << nLoops << " iterations with strings of length " << nLen << ":\n\n";
-
-    // Create a local variable testString instead of using VC++'s non-standard extension
-    // (conversion from X to X&)
-    #define RUN_TEST( TEST_NAME ) \
-    { \
-        TEST_NAME::String testString; \
-        cout << "  " << setw(15) << #TEST_NAME; \
-        cout << setw(7) << Test(testString, nLoops, nLen ); \
-        cout << "ms  copies:" << setw(8) << TEST_NAME::String::nCopies \
-             << "  allocs:" << setw(8) << TEST_NAME::String::nAllocs \
-             << endl; \
-    }
-
-
-    for( int i = 1; i <= nRuns; ++i )
-    {
-        RUN_TEST( Plain_FastAlloc );
-        RUN_TEST( Plain );
-        RUN_TEST( COW_Unsafe );
-        RUN_TEST( COW_AtomicInt );
-        RUN_TEST( COW_AtomicInt2 );
-        RUN_TEST( COW_CritSec );
-        RUN_TEST( COW_Mutex );
-        
-        RUN_TEST( StdString );
-        RUN_TEST( AtlString );
-
-        cout << endl;
-    }
-
-#else
-
-    cout << "done.\nRunning " << nLoops << " iterations for integer operations:\n\n";
-    TestIntOps( nRuns, nLoops );
-
-#endif
-
-    return 0;
-}
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//==============================================================================
+//
+//  Guru of the Week #45: Sample code, and performance test harness.
+//
+//  Version 2.0: Changes include the following:
+//
+//      - changed reference count from unsigned to long, and "unshareable"
+//          state is now flagged by a negative number
+//
+//      - changed IntAtomicGet to IntAtomicCompare
+//
+//      - inlined everything
+//
+//      - changed AboutToModify to EnsureUnique and EnsureUnshareable, in order
+//          to avoid passing the "bMarkUnshareable" bool as a runtime flag when
+//          this is after all known at compile time
+//
+//      - created fixed-size allocator (i.e., "fast allocator") for StringBuf
+//          to eliminate any issues related to double allocation penalties
+//
+//      - added alternatively-optimized COW test cases, include COW_AtomicInt2
+//          that avoids a secondary allocation by using a single buffer for the
+//          len/used/refs values and the string data
+//
+//      - added non-COW test cases, including one that uses a fast allocator
+//          (the original version compared only various thread-safe and -unsafe
+//          flavours of COW, and didn't compare plain non-COW)
+//
+//      - added native x86 assembler versions of the AtomicInt functions to
+//          show that the Win32 operations were equally efficient (no, there's
+//          no function-call overhead)
+//
+//      - added ability to test copying and Append, in addition to operator[],
+//          which also meant adding a function to shrink a string
+//
+//      - changed from calling copy to calling memcpy... on my compiler,
+//          memcpy was about three times faster (indicating that perhaps this
+//          implementation ought to specialize copy for builtin types), and
+//          the majority of COW's performance advantage came from avoiding the
+//          inefficient copy, not from avoiding the allocation
+//
+//      - a lot of miscellaneous things I probably forgot to document
+//
+//  Copyright (c) 1998 by H.P.Sutter. All rights reserved. You may download and
+//  compile and play with this code to your heart's content, but you may not
+//  redistribute it; instead, please just include a link to this code at the
+//  official GotW site.
+//
+//==============================================================================
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#ifdef _MSC_VER
+#include <atlstr.h>
+#endif
+#include <malloc.h>
+using namespace std;
+
+//  Test.H contains sample definitions for CriticalSection, Mutex, IntAtomicXxx,
+//  FastArena, and Timer. You will need to supply your own definitions here;
+//  these classes are highly operating system-specific.
+//
+#include "test.h"   // *** you must implement this yourself ***
+#include "stdstring-cow.h"
+
+
+
+//--- Uncomment exactly one #define corresponding to the test you wish you run,
+//    then rebuild and run (using command-line parameters to vary the number
+//    of iterations, etc.).
+
+//#define TEST_CONST_COPY       1
+//#define TEST_APPEND           1
+//#define TEST_OPERATOR         1
+
+//#define TEST_INT_OPS_ONLY     1
+
+//#define TEST_SHARED_READERS   1   // multi-threaded, see TestSharedReaders
+//#define TEST_LOCKS            1   // multi-threaded, see TestLock
+
+#define TEST_MUTATING_COPY_2A 1
+//#define TEST_MUTATING_COPY_2B 1
+
+//--- Optionally uncomment one of these too, to run the test selected above on
+//    many threads at once (see TestTimed).
+
+//#define TEST_OVERSUBSCRIBED   1   // 1x to 8x more threads than cores
+//#define TEST_SCALING          1   // 1, 2, 4, ... pinned threads
+
+//--- ...or one of these, to time the test selected above on String,
+//    CountedString and TracedString (see NoInstr, CountInstr and TraceInstr in
+//    test.h), or to trace it and summarise the trace.
+
+//#define TEST_INSTR_COST       1
+//#define TEST_TRACE            1   // dumps trace-*.bin, see AnalyzeTrace
+
+//--- ...or this, to time the test selected above on COW_AtomicInt2 and
+//    COW_LazyAtomic before and after the program starts a second thread, and
+//    then on many threads (see ThreadsStarted in test.h).
+
+//#define TEST_LAZY_ATOMIC      1
+
+//--- ...or this, to time the test selected above on COW_Ordered with every
+//    legal combination of memory orders for its reference count, on one
+//    thread and then on many (see Orders).
+
+//#define TEST_MEMORY_ORDER     1
+
+//--- ...or this, for const copies that are only read, and reads of one
+//    String, on the Strings that have read-only At (see TestReadHeavy).
+
+//#define TEST_READ_HEAVY       1
+
+//--- ...or this, for a workload of its own run under the sampling profiler.
+
+//#define TEST_PROFILE          1   // see ProfiledWorkload
+
+//--- ...or this, to run that workload on Plain and StdString and report, per
+//    call site, how many copies were never written to or could have been
+//    moves (see Tracked).
+
+//#define TEST_USEFULNESS       1
+
+//--- ...or this, to time Plain, COW_AtomicInt2 and Adaptive on copies of which
+//    0% to 100% are then mutated (see TestMutationRatio).
+
+//#define TEST_MUTATION_SWEEP   1
+
+//--- ...or this, to compare the capacity Plain's copies get, and to build
+//    strings with and without a capacity hint (see TestCopyCapacity).
+
+//#define TEST_COPY_CAPACITY    1
+
+//--- ...or this, to pass strings to and return them from functions that
+//    aren't inlined, by value, const& and rvalue (see TestBoundary).
+
+//#define TEST_FUNCTION_BOUNDARY 1
+
+//--- ...or this, to hand strings from producer threads to consumer threads
+//    through a lock-free queue, copied, moved or shared (see TestHandoff).
+
+//#define TEST_HANDOFF          1
+
+//--- ...or this, to pass strings down a pipeline of C++20 coroutines, copied
+//    or moved between stages (see TestPipeline; needs /std:c++latest).
+
+//#define TEST_COROUTINE_PIPELINE 1
+
+//--- ...or this, to time a batch job over a corpus of records on a work-
+//    stealing thread pool, as an application-level number (see TestBatch).
+
+//#define TEST_BATCH            1
+
+//--- ...or this, to recommend an implementation for the workload described
+//    on the command line (see Tune).
+
+//#define TEST_TUNE             1
+
+//--- Uncomment this as well to publish live progress, for watching a long run
+//    with "TestCowStrings -monitor" (see LiveStats in test.h).
+
+//#define TEST_LIVE             1
+
+#ifdef TEST_LIVE
+#define LIVE_OPS( n )                               LiveStats::AddOps( n )
+#define LIVE_RUN( scenario, name, threads, stats )  LiveStats::Begin( scenario, name, threads, stats )
+#else
+#define LIVE_OPS( n )
+#define LIVE_RUN( scenario, name, threads, stats )
+#endif
+
+//--- Comment this out to inline the slow paths (unshare, grow, clone) into
+//    every Append and operator[] again, which is how GotW #45 had them. See
+//    codesize.py for comparing the hot loops of the two builds.
+
+#define TEST_COLD_PATHS       1
+
+//  COLD marks the slow path of an implementation, so that the fast path it
+//  was split from stays small enough to inline into hot loops without
+//  dragging a deep copy along. LIKELY and UNLIKELY tell compilers that take
+//  a hint (MSVC doesn't) which way the branch to it goes.
+//
+#ifdef TEST_COLD_PATHS
+#define COLD                __declspec(noinline)
+#else
+#define COLD                inline
+#endif
+
+#if defined TEST_COLD_PATHS && defined __GNUC__
+#define LIKELY( x )         __builtin_expect( !!(x), 1 )
+#define UNLIKELY( x )       __builtin_expect( !!(x), 0 )
+#else
+#define LIKELY( x )         (x)
+#define UNLIKELY( x )       (x)
+#endif
+
+//--- Uncomment this to have Plain, COW_AtomicInt2 and the COW strings from
+//    common-test.h take their buffers from RecycleCache (see test.h) rather
+//    than new[] and delete[]. The single-threaded tests then print how many
+//    allocations it served, and how many heap calls were left.
+
+//#define TEST_RECYCLE          1
+
+#ifdef TEST_RECYCLE
+#define NEW_CHARS( n )          RecycleCache::Allocate( n )
+#define DELETE_CHARS( p, n )    RecycleCache::Free( p, n )
+#else
+#define NEW_CHARS( n )          new char[ n ]
+#define DELETE_CHARS( p, n )    delete[] (p)
+#endif
+
+
+
+//------------------------------------------------------------------------------
+//
+//  Non-COW: Here's the original unoptimized version from GotW #43,
+//  plus Length() and operator[]() functions.
+//
+//  The capacity a copy gets is up to C: CopyInherited (GotW's, and String's)
+//  gives it the source's whole buffer, slack from 1.5x growth and all;
+//  CopyExact just the characters; CopySizeClass those rounded up to a power
+//  of two (and at least 16). TEST_COPY_CAPACITY compares the three. A String
+//  constructed with a capacity hint starts empty with that much room.
+//
+//  The auto-tuner (TEST_TUNE) varies the rest too: how Append grows a full
+//  buffer (G: Grow1_5x, GotW's, or Grow2x), where buffers come from (A:
+//  HeapChars, which is new[], or RecycledChars, which is RecycleCache), and
+//  how many characters the String holds in itself before it needs a buffer
+//  at all (nSso, none by default). Those live in the inline buffer, which
+//  then always has nSso chars of room, and String has one of 0 bytes.
+//
+//------------------------------------------------------------------------------
+
+  namespace Plain {
+
+    struct CopyInherited {
+        static size_t Capacity( size_t /*used*/, size_t len ) { return len; }
+    };
+
+    struct CopyExact {
+        static size_t Capacity( size_t used, size_t /*len*/ ) { return used; }
+    };
+
+    struct CopySizeClass {
+        static size_t Capacity( size_t used, size_t /*len*/ ) {
+          size_t cap = 16;
+          while( cap < used ) {
+            cap *= 2;
+          }
+          return used ? cap : 0;
+        }
+    };
+
+    struct Grow1_5x {
+        static size_t Capacity( size_t len, size_t n ) {
+          size_t needed = static_cast<size_t>(max(len*1.5, static_cast<double>(n)));
+          return needed ? 4 * ((needed-1)/4 + 1) : 0;
+        }
+    };
+
+    struct Grow2x {
+        static size_t Capacity( size_t len, size_t n ) {
+          return max( 2 * len, max( n, static_cast<size_t>(16) ) );
+        }
+    };
+
+    struct HeapChars {
+        static char* New( size_t n )             { return NEW_CHARS( n ); }
+        static void  Delete( char* p, size_t n ) { UNREFERENCED_PARAMETER( n ); DELETE_CHARS( p, n ); }
+    };
+
+    struct RecycledChars {
+        static char* New( size_t n )             { return RecycleCache::Allocate( n ); }
+        static void  Delete( char* p, size_t n ) { RecycleCache::Free( p, n ); }
+    };
+
+    template<size_t N>
+    struct InlineChars {
+        char* Inline() { return chars_; }
+        char  chars_[N];
+    };
+
+    template<>
+    struct InlineChars<0> {
+        char* Inline() { return 0; }
+    };
+
+    template<class I, class C = CopyInherited, class G = Grow1_5x, class A = HeapChars, size_t nSso = 0>
+    class BasicString : InlineChars<nSso> {
+    public:
+        BasicString();           // start off empty
+        explicit BasicString( size_t capacity ); // empty, with room for capacity
+       ~BasicString();           // free the buffer
+        BasicString( const BasicString& ); // take a full copy
+        BasicString( BasicString&& ); // take other's buffer, leave it empty
+        void Clear();
+        void Append( char );     // append one character
+        size_t Length() const;
+        size_t Capacity() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;
+
+        static Stats stats;
+    private:
+        void Allocate( size_t ); // room for n chars: a new buffer, or the inline one
+        void Release();          // free the buffer, unless it's the inline one
+        void Reserve( size_t );
+        void Grow( size_t );     // the out-of-line part of Reserve
+        char*    buf_;           // allocated buffer
+        size_t   len_;           // length of buffer
+        size_t   used_;          // # chars actually used
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I, class C, class G, class A, size_t nSso> Stats BasicString<I, C, G, A, nSso>::stats;
+
+    template<class I, class C, class G, class A, size_t nSso>
+    BasicString<I, C, G, A, nSso>::BasicString() : buf_(this->Inline()), len_(nSso), used_(0) { }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    BasicString<I, C, G, A, nSso>::BasicString( size_t capacity )
+    : used_(0)
+    {
+      Allocate( capacity );
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    BasicString<I, C, G, A, nSso>::~BasicString() { I::OnFree( stats, len_ ); Release(); }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    BasicString<I, C, G, A, nSso>::BasicString( const BasicString& other )
+    : used_(other.used_)
+    {
+      Allocate( nSso && used_ <= nSso ? nSso : C::Capacity(other.used_, other.len_) );
+      if( buf_ ) {
+        memcpy( buf_, other.buf_, used_ );
+        I::OnDeepCopy( stats, used_ );
+      }
+      I::OnCopy( stats );
+    }
+
+    //  Characters in the inline buffer can only be copied across.
+    //
+    template<class I, class C, class G, class A, size_t nSso>
+    BasicString<I, C, G, A, nSso>::BasicString( BasicString&& other )
+    : buf_(other.buf_),
+      len_(other.len_),
+      used_(other.used_)
+    {
+      if( nSso && len_ <= nSso ) {
+        buf_ = this->Inline();
+        memcpy( buf_, other.buf_, used_ );
+      }
+      other.buf_  = other.Inline();
+      other.len_  = nSso;
+      other.used_ = 0;
+      I::OnMove( stats );
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline void BasicString<I, C, G, A, nSso>::Clear() {
+      Release();
+      buf_ = this->Inline();
+      len_ = nSso;
+      used_ = 0;
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline void BasicString<I, C, G, A, nSso>::Allocate( size_t n ) {
+      if( n > nSso ) {
+        buf_ = A::New( n );
+        len_ = n;
+        I::OnAlloc( stats, len_ );
+      }
+      else {
+        buf_ = this->Inline();
+        len_ = nSso;
+      }
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline void BasicString<I, C, G, A, nSso>::Release() {
+      if( !nSso || len_ > nSso ) {
+        A::Delete( buf_, len_ );
+      }
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline void BasicString<I, C, G, A, nSso>::Reserve( size_t n ) {
+      if( UNLIKELY( len_ < n ) ) {
+        Grow( n );
+      }
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    COLD void BasicString<I, C, G, A, nSso>::Grow( size_t n ) {
+      size_t newlen = G::Capacity( len_, n );
+      char*  newbuf = newlen ? (I::OnAlloc( stats, newlen ), A::New( newlen )) : 0;
+      if( buf_ )
+      {
+          memcpy( newbuf, buf_, used_ );
+          I::OnGrow( stats, used_ );
+      }
+
+      Release();      // now all the real work is
+      buf_ = newbuf;  //  done, so take ownership
+      len_ = newlen;
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline void BasicString<I, C, G, A, nSso>::Append( char c ) {
+      Reserve( used_+1 );
+      buf_[used_++] = c;
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline size_t BasicString<I, C, G, A, nSso>::Length() const {
+      return used_;
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline size_t BasicString<I, C, G, A, nSso>::Capacity() const {
+      return len_;
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline char& BasicString<I, C, G, A, nSso>::operator[]( size_t n ) {
+      return *(buf_+n);
+    }
+
+    template<class I, class C, class G, class A, size_t nSso>
+    inline char BasicString<I, C, G, A, nSso>::At( size_t n ) const {
+      return *(buf_+n);
+    }
+
+  }
+
+
+
+//------------------------------------------------------------------------------
+//
+// std::string
+//
+//------------------------------------------------------------------------------
+
+  namespace StdString {
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();           // start off empty
+       ~BasicString();           // free the buffer
+        BasicString( const BasicString& ); // take a full copy
+        BasicString( BasicString&& );      // take other's std::string
+        void Clear();
+        void Append( char );     // append one character
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;
+
+        // *** NOTE: Only copies and moves are counted; std::string's own
+        //           allocations and deep copies aren't visible from here
+        static Stats stats;
+    private:
+        std::string _s;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    template<class I>
+    BasicString<I>::BasicString() { }
+
+    template<class I>
+    BasicString<I>::~BasicString() { }
+
+    template<class I>
+    BasicString<I>::BasicString( const BasicString& other )
+    : _s(other._s)
+    {
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    BasicString<I>::BasicString( BasicString&& other )
+    : _s(std::move(other._s))
+    {
+      I::OnMove( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+        _s.clear();
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+        _s += c;
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return _s.size();
+    }
+
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      return _s[n];
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      return _s[n];
+    }
+
+  }
+
+
+//------------------------------------------------------------------------------
+//
+// libstdc++'s old reference-counted std::string (see stdstring-cow.h)
+//
+//------------------------------------------------------------------------------
+
+#if defined __GLIBCXX__
+
+  namespace StdStringCow {
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();           // start off empty
+       ~BasicString();           // release the rep
+        BasicString( const BasicString& ); // share the rep
+        void Clear();
+        void Append( char );     // append one character
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;
+
+        // *** NOTE: Only copies are counted, as for StdString
+        static Stats stats;
+    private:
+        StdCowString _s;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    template<class I>
+    BasicString<I>::BasicString() { }
+
+    template<class I>
+    BasicString<I>::~BasicString() { }
+
+    template<class I>
+    BasicString<I>::BasicString( const BasicString& other )
+    : _s(other._s)
+    {
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+        _s.Clear();
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+        _s.Append( c );
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return _s.Length();
+    }
+
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      return _s[n];
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      return _s.At( n );
+    }
+
+  }
+
+#endif
+
+
+  
+//------------------------------------------------------------------------------
+//
+// ATL CStringA (MSVC only)
+//
+//------------------------------------------------------------------------------
+
+#ifdef _MSC_VER
+
+  namespace AtlString {
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();           // start off empty
+       ~BasicString();           // free the buffer
+        BasicString( const BasicString& ); // take a full copy
+        void Clear();
+        void Append( char );     // append one character
+        size_t Length() const;
+        char  operator[](size_t) const; // char& not possible on CString
+
+        // *** NOTE: Only copies are counted; CString's own
+        //           allocations and deep copies aren't visible from here
+        static Stats stats;
+    private:
+        ATL::CStringA _s;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    template<class I>
+    BasicString<I>::BasicString() { }
+
+    template<class I>
+    BasicString<I>::~BasicString() { }
+
+    template<class I>
+    BasicString<I>::BasicString( const BasicString& other )
+    : _s(other._s)
+    {
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+        _s.Empty();
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+        _s += c;
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return _s.GetLength();
+    }
+
+    template<class I>
+    inline char BasicString<I>::operator[]( size_t n ) const {
+      return _s.GetAt(static_cast<int>(n));
+    }
+
+  }
+
+#endif
+
+
+
+
+
+//------------------------------------------------------------------------------
+//
+//  Non-COW: Same as above, but optimized to use a more efficient allocator
+//  instead of the built-in library allocator.
+//
+//------------------------------------------------------------------------------
+
+  namespace Plain_FastAlloc {
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();           // start off empty
+       ~BasicString();           // free the buffer
+        BasicString( const BasicString& ); // take a full copy
+        void Clear();
+        void Append( char );     // append one character
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;
+
+        static Stats stats;
+    private:
+        void Reserve( size_t );
+        void Grow( size_t );     // the out-of-line part of Reserve
+        char*    buf_;           // allocated buffer
+        size_t   len_;           // length of buffer
+        size_t   used_;          // # chars actually used
+        static FastArena fa;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+    template<class I> FastArena BasicString<I>::fa( "Plain_FastAlloc" );
+
+    template<class I>
+    BasicString<I>::BasicString() : buf_(0), len_(0), used_(0) { }
+
+    template<class I>
+    BasicString<I>::~BasicString() { I::OnFree( stats, len_ ); fa.Deallocate(buf_); }
+
+    template<class I>
+    BasicString<I>::BasicString( const BasicString& other )
+    : buf_((char*)fa.Allocate(other.len_)),
+      len_(other.len_),
+      used_(other.used_)
+    {
+      memcpy( buf_, other.buf_, used_ );
+      I::OnCopy( stats );
+      I::OnAlloc( stats, len_ );
+      I::OnDeepCopy( stats, used_ );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      fa.Deallocate(buf_);
+      buf_ = 0;
+      len_ = 0;
+      used_ = 0;
+    }
+
+    template<class I>
+    inline void BasicString<I>::Reserve( size_t n ) {
+      if( UNLIKELY( len_ < n ) ) {
+        Grow( n );
+      }
+    }
+
+    template<class I>
+    COLD void BasicString<I>::Grow( size_t n ) {
+      size_t needed = static_cast<size_t>(max(len_*1.5, static_cast<double>(n)));
+
+      size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
+      char*  newbuf = newlen ? (I::OnAlloc( stats, newlen ), (char*)fa.Allocate(newlen)) : 0;
+      if( buf_ )
+      {
+          memcpy( newbuf, buf_, used_ );
+          I::OnGrow( stats, used_ );
+      }
+
+      fa.Deallocate(buf_); // now all the real work is
+      buf_ = newbuf;       //  done, so take ownership
+      len_ = newlen;
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+      Reserve( used_+1 );
+      buf_[used_++] = c;
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return used_;
+    }
+
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      return *(buf_+n);
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      return *(buf_+n);
+    }
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Initial thread-unsafe implementation.
+//
+//==============================================================================
+
+  namespace COW_Unsafe {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #define NAME    "COW_Unsafe"
+    #define BAGGAGE
+    #include "common-test.h" //****************************************************
+
+    template<class I>
+    inline BasicString<I>::~BasicString() {
+      if( --data_->refs < 1 ) {
+        delete data_;
+      }
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+    {
+      if( other.data_->refs > 0 ) {
+        data_ = other.data_;
+        ++data_->refs;
+        I::OnShare( stats );
+      } else {
+        data_ = new StringBuf( *other.data_ );
+      }
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      if( data_->refs > 1 ) {
+        --data_->refs;
+        data_ = new StringBuf;
+      } else {
+        data_->Clear();
+        data_->refs = 1; // shareable again
+      }
+    }
+
+    template<class I>
+    inline void BasicString<I>::EnsureUnique( size_t n ) {
+      I::OnRefsRead( stats );
+      if( UNLIKELY( data_->refs > 1 ) ) {
+        I::OnUnshare( stats );
+        StringBuf* newdata = new StringBuf( *data_, n );
+        --data_->refs;   // now all the real work is
+        data_ = newdata; //  done, so take ownership
+      } else {
+        data_->Reserve( n );
+        data_->refs = 1; // shareable again
+      }
+    }
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Safe implementation, using atomic integer manipulation functions.
+//
+//==============================================================================
+
+  namespace COW_AtomicInt {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #define NAME    "COW_AtomicInt"
+    #define BAGGAGE
+    #include "common-test.h" //****************************************************
+
+    template<class I>
+    inline BasicString<I>::~BasicString() {
+      if( IntAtomicDecrement( data_->refs ) < 1 ) {
+        delete data_;
+      }
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+    {
+      if( IntAtomicCompare( other.data_->refs, 0 ) > 0 ) {
+        data_ = other.data_;
+        IntAtomicIncrement( data_->refs );
+        I::OnShare( stats );
+      }
+      else {
+        data_ = new StringBuf( *other.data_ );
+      }
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      if( IntAtomicDecrement( data_->refs ) < 1 ) {
+        data_->Clear();  // also covers case where two
+        data_->refs = 1; //  threads are trying this at once
+      }
+      else {
+        data_ = new StringBuf;
+      }
+    }
+
+    template<class I>
+    inline void BasicString<I>::EnsureUnique( size_t n ) {
+      I::OnRefsRead( stats );
+      if( UNLIKELY( IntAtomicCompare( data_->refs, 1 ) > 0 ) ) {
+        I::OnUnshare( stats );
+        StringBuf* newdata = new StringBuf( *data_, n );
+        if( IntAtomicDecrement( data_->refs ) < 1 ) {
+          delete newdata;  // just in case two threads
+          data_->refs = 1; //  are trying this at once
+        }
+        else {             // now all the real work is
+          data_ = newdata; //  done, so take ownership
+        }
+      }
+      else {
+        data_->Reserve( n );
+        data_->refs = 1; // shareable again
+      }
+    }
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Safe implementation, using atomic integer manipulation functions.
+//       AND a single buffer containing both the StringBuf control data.
+//
+//       The only thing I'm not doing is optimizing the empty-string case,
+//       because if I did that here I should also do it in the Plain case.
+//       Since all implementations are doing it the same way (not optimizing
+//       the empty-string case), they can be meaningfully compared. Besides,
+//       the more you optimize the more complicated it gets.
+//
+//       MORAL: Never start optimizing before you: a) know you need to;
+//              and b) know that you actually are!
+//
+//==============================================================================
+
+  namespace COW_AtomicInt2 {
+
+    //  The layout of the StringBuf object sits in the initial bytes of a
+    //  dynamically-allocated char buffer of length sizeof(StringBuf)+len.
+    //  If you want to change this "glommed" buffer's size, you have to make a
+    //  new one... hence Reserve is no longer a member of StringBuf.
+    //
+    struct StringBuf {
+        size_t   len;
+        size_t   used;
+        long     refs;
+    };
+
+    #undef  REF_COUNT
+    #define REF_COUNT AtomicRefs
+
+    #define LEN(x)   (((StringBuf*)(x))->len)
+    #define USED(x)  (((StringBuf*)(x))->used)
+    #define REFS(x)  (((StringBuf*)(x))->refs)
+    #define BUF(x)   ((x) + sizeof(StringBuf))
+
+    #include "cow-atomic-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  COW: COW_AtomicInt2, with IntMaybeAtomicXxx (see test.h) for the reference
+//       count, so that it costs no more than COW_Unsafe's until the program
+//       starts a second thread. After that, every update costs an extra
+//       test of ThreadsStarted on top of COW_AtomicInt2's interlocked op.
+//
+//==============================================================================
+
+  namespace COW_LazyAtomic {
+
+    struct StringBuf {
+        size_t   len;
+        size_t   used;
+        long     refs;
+    };
+
+    #undef  REF_COUNT
+    #define REF_COUNT MaybeAtomicRefs
+    #include "cow-atomic-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  COW: COW_AtomicInt2, plus a "known unique" bit in the low bit of the
+//       String's own pointer to its buffer (new[] never returns an odd
+//       address). The bit is set whenever this String creates or clones a
+//       buffer, so it's the only holder, and cleared when the buffer gets
+//       shared. While it's set, EnsureUnique doesn't have to read refs from
+//       the buffer, so an Append only touches len and used. Once it's clear,
+//       the refs check runs as in COW_AtomicInt2, and sets the bit again if
+//       the other holders have all gone.
+//
+//       Sharing clears the bit in the source String too, so the copy
+//       constructor writes to the String it copies from, which two threads
+//       may be copying at once. So the pointer is a std::atomic, read and
+//       written relaxed (plain moves on x86), and the bit is only cleared
+//       while it's set.
+//
+//==============================================================================
+
+  namespace COW_TaggedUnique {
+
+    struct StringBuf {
+        size_t   len;
+        size_t   used;
+        long     refs;
+    };
+
+    const size_t nUniqueBit = 1;
+
+    #undef  REF_COUNT
+    #define REF_COUNT AtomicRefs
+    #define TAGGED_UNIQUE
+    #include "cow-atomic-test.h" //**************************************************
+    #undef  TAGGED_UNIQUE
+
+  }
+
+
+//==============================================================================
+//
+//  COW: COW_AtomicInt2 on std::atomic, with the memory order of each kind of
+//       reference count operation left open (the Win32 Interlocked functions
+//       are all full barriers). Orders<Inc, Dec, Chk> gives the orders for:
+//
+//       Inc  taking a new reference. Nothing is published by it, so relaxed
+//            is enough.
+//       Dec  dropping one. The last holder frees the buffer, so every other
+//            holder's reads of it must happen before that: release on each
+//            decrement, and acquire for the one that frees it. That's acq_rel
+//            or seq_cst on the decrement itself, or release with an acquire
+//            fence taken only when the count reaches zero.
+//       Chk  reading the count to find out whether this String is the only
+//            holder, before writing to the buffer in place. Other holders may
+//            have been reading it until their (release) decrement, so this
+//            must be at least acquire.
+//
+//       Relaxed is only legal for Inc, which static_assert enforces. String
+//       is the weakest legal combination. TEST_MEMORY_ORDER times all of them.
+//
+//==============================================================================
+
+  namespace COW_Ordered {
+
+    template<memory_order Inc, memory_order Dec, memory_order Chk>
+    struct Orders {
+        static_assert( Dec == memory_order_seq_cst || Dec == memory_order_acq_rel
+                       || Dec == memory_order_release, "Dec must be at least release" );
+        static_assert( Chk == memory_order_seq_cst || Chk == memory_order_acquire,
+                       "Chk must be acquire or seq_cst" );
+
+        typedef atomic<long> Count;
+
+        static void Init( Count& refs, long v ) {
+          new( &refs ) atomic<long>( v );
+        }
+
+        //  Only by the unique holder, so nobody else is looking.
+        //
+        static void Set( Count& refs, long v ) {
+          refs.store( v, memory_order_relaxed );
+        }
+
+        static void Increment( Count& refs ) {
+          refs.fetch_add( 1, Inc );
+        }
+
+        //  Returns the new count.
+        //
+        static long Decrement( Count& refs ) {
+          long n = refs.fetch_sub( 1, Dec ) - 1;
+          if( Dec == memory_order_release && n < 1 ) {
+            atomic_thread_fence( memory_order_acquire );
+          }
+          return n;
+        }
+
+        static long Compare( Count& refs, long v ) {
+          long n = refs.load( Chk );
+          return n < v ? -1 : ( n == v ? 0 : 1 );
+        }
+
+        //  Whoever copies a String already has it to themselves (or shares
+        //  it read-only), so the unshareable check needs no ordering of its
+        //  own.
+        //
+        static bool Shareable( Count& refs ) {
+          return refs.load( memory_order_relaxed ) > 0;
+        }
+    };
+
+    typedef Orders<memory_order_relaxed, memory_order_release, memory_order_acquire> WeakestOrders;
+
+    //  As COW_AtomicInt2's, except that refs is atomic.
+    //
+    struct StringBuf {
+        size_t       len;
+        size_t       used;
+        atomic<long> refs;
+    };
+
+    #undef  REF_COUNT
+    #define REF_COUNT WeakestOrders
+    #include "cow-atomic-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  COW: COW_AtomicInt2's single buffer, but data_ points at the first
+//       character, and the StringBuf header sits just before it (as in
+//       libstdc++'s old std::string, whose _Rep is found the same way). So
+//       At and c_str are a load from data_, with no sizeof(StringBuf) to add
+//       on, and only the reference count and length operations go backwards
+//       to the header. The characters are kept NUL-terminated for c_str,
+//       one byte past len.
+//
+//==============================================================================
+
+  namespace COW_CharPtr {
+
+    struct StringBuf {
+        size_t   len;
+        size_t   used;
+        long     refs;
+    };
+
+    #undef  REF_COUNT
+    #undef  LEN
+    #undef  USED
+    #undef  REFS
+    #undef  BUF
+    #define REF_COUNT AtomicRefs
+    #define REP(x)   ((StringBuf*)((x) - sizeof(StringBuf)))
+    #define LEN(x)   (REP(x)->len)
+    #define USED(x)  (REP(x)->used)
+    #define REFS(x)  (REP(x)->refs)
+    #define BUF(x)   (x)
+    #define CHAR_PTR
+    #include "cow-atomic-test.h" //**************************************************
+    #undef  CHAR_PTR
+    #undef  REP
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Safe implementation, using a critical section.
+//
+//==============================================================================
+
+  namespace COW_CritSec {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_CritSec"
+    #define LOCK_TYPE CriticalSection
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Safe implementation, using a mutex.
+//
+//==============================================================================
+
+  namespace COW_Mutex {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_Mutex"
+    #define LOCK_TYPE Mutex
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  COW: Safe implementations using the other Lock<T>-compatible locks from
+//       test.h (see there for how each one works). The code is the same as
+//       COW_CritSec's and COW_Mutex's, from cow-lock-test.h.
+//
+//==============================================================================
+
+  namespace COW_SpinLock {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_SpinLock"
+    #define LOCK_TYPE SpinLock
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+  namespace COW_TicketLock {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_TicketLock"
+    #define LOCK_TYPE TicketLock
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+  namespace COW_McsLock {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_McsLock"
+    #define LOCK_TYPE McsLock
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+  namespace COW_FutexLock {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_FutexLock"
+    #define LOCK_TYPE FutexLock
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+  namespace COW_StdMutex {
+
+    #undef  NAME
+    #undef  BAGGAGE
+    #undef  LOCK_TYPE
+    #define NAME      "COW_StdMutex"
+    #define LOCK_TYPE StdMutex
+    #define BAGGAGE   LOCK_TYPE lk
+    #include "common-test.h" //****************************************************
+    #include "cow-lock-test.h" //**************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  Non-COW, for strings that several threads read far more often than anyone
+//  writes them: the buffer pointer, length and contents are guarded by a
+//  sequence lock (see SeqCount in test.h). A reader takes its snapshot and
+//  just retries if a writer got in meanwhile. Readers take no lock and there
+//  is no reference count for them to bump, so they don't all fight over one
+//  cache line the way COW copies fight over refs.
+//
+//  The catch is that a reader may still be looking at the old buffer after a
+//  writer has grown the string, so an outgrown buffer can't be freed until
+//  the String itself goes. Each buffer remembers the one it replaced and the
+//  destructor frees the whole chain; with 1.5x growth that adds up to less
+//  than twice the current capacity.
+//
+//==============================================================================
+
+  namespace SeqLock {
+
+    //  Every buffer starts with this header; buf_ points just past it.
+    //
+    struct BufHeader {
+        char*    prev;           // buffer this one replaced, or 0
+        size_t   len;            // capacity, fixed for the buffer's lifetime
+    };
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();
+       ~BasicString();
+        BasicString( const BasicString& ); // snapshot copy; doesn't lock other
+        void   Clear();
+        void   Append( char );
+        void   Assign( const char*, size_t ); // rewrite as a single update
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;
+        size_t Read( char* dst, size_t n ) const; // copies up to n chars,
+                                                  //  returns the full length
+        static Stats stats;
+    private:
+        void  Reserve( size_t n ); // only between WriteBegin and WriteEnd
+        void  Grow( size_t n );
+        static char* NewBuf( size_t len, char* prev );
+        char* volatile  buf_;
+        volatile size_t used_;
+        SeqCount        seq_;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    #define HDR(x)   ((BufHeader*)((x) - sizeof(BufHeader)))
+
+    template<class I>
+    inline char* BasicString<I>::NewBuf( size_t len, char* prev ) {
+      char* p = ( I::OnAlloc( stats, sizeof(BufHeader) + len ), new char[ sizeof(BufHeader) + len ] );
+      ((BufHeader*)p)->prev = prev;
+      ((BufHeader*)p)->len  = len;
+      return p + sizeof(BufHeader);
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString() : buf_(NewBuf( 0, 0 )), used_(0) { }
+
+    template<class I>
+    inline BasicString<I>::~BasicString() {
+      char* b = buf_;
+      while( b ) {
+        char* prev = HDR(b)->prev;
+        I::OnFree( stats, HDR(b)->len );
+        delete[] (b - sizeof(BufHeader));
+        b = prev;
+      }
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+      : buf_(NewBuf( other.Length(), 0 )), used_(0)
+    {
+      size_t n;
+      while( (n = other.Read( buf_, HDR(buf_)->len )) > HDR(buf_)->len ) {
+        delete[] (buf_ - sizeof(BufHeader)); // other grew meanwhile; nobody
+        buf_ = NewBuf( n, 0 );               //  else can see ours yet
+      }
+      used_ = n;
+      I::OnCopy( stats );
+      I::OnDeepCopy( stats, n );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      seq_.WriteBegin();
+      used_ = 0;             // keep the buffer, a reader may be in it
+      seq_.WriteEnd();
+    }
+
+    template<class I>
+    inline void BasicString<I>::Reserve( size_t n ) {
+      if( UNLIKELY( HDR(buf_)->len < n ) ) {
+        Grow( n );
+      }
+    }
+
+    template<class I>
+    COLD void BasicString<I>::Grow( size_t n ) {
+      size_t needed = static_cast<size_t>(max(HDR(buf_)->len*1.5, static_cast<double>(n)));
+
+      size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
+      char*  newbuf = NewBuf( newlen, buf_ );
+      memcpy( newbuf, buf_, used_ );
+      I::OnGrow( stats, used_ );
+      buf_ = newbuf;       // the old one is retired, not freed
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+      seq_.WriteBegin();
+      Reserve( used_+1 );
+      buf_[used_] = c;
+      used_ = used_ + 1;
+      seq_.WriteEnd();
+    }
+
+    template<class I>
+    inline void BasicString<I>::Assign( const char* p, size_t n ) {
+      seq_.WriteBegin();
+      Reserve( n );
+      memcpy( buf_, p, n );
+      used_ = n;
+      seq_.WriteEnd();
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return used_;
+    }
+
+    //  Writes through the returned reference bypass the sequence count, so
+    //  only use it on a string that nobody is reading concurrently.
+    //
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      return *(buf_+n);
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      for( ;; ) {
+        long   s = seq_.ReadBegin();
+        char*  b = buf_;
+        char   c = n < HDR(b)->len ? b[n] : 0;
+        if( !seq_.ReadRetry( s ) ) {
+          return c;
+        }
+      }
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Read( char* dst, size_t n ) const {
+      for( ;; ) {
+        long   s = seq_.ReadBegin();
+        char*  b = buf_;
+        size_t u = used_;    // b and u may be torn; never read past b's end
+        memcpy( dst, b, min( min( u, HDR(b)->len ), n ) );
+        if( !seq_.ReadRetry( s ) ) {
+          return u;
+        }
+      }
+    }
+
+  }
+
+
+//==============================================================================
+//
+//  Adaptive: COW_AtomicInt2's single-buffer layout, but each copy either
+//  shares the buffer or takes a deep copy up front, as Plain does, depending
+//  on how often copies from the same allocation site have turned out to be
+//  mutated. Sharing saves the allocation and memcpy on copies that stay
+//  const. It costs a couple of interlocked ops and a later unshare for copies
+//  that don't, and when nearly all copies are mutated that's pure overhead.
+//
+//  A site is an AdaptiveSite that the original string was constructed with,
+//  or the per-type default. Copies inherit it. Each thread counts down its
+//  own nAdaptiveWindow copies (in a per-ThreadSlot block, as Stats does), and
+//  at the end of its window the site looks at how many copies were mutated
+//  since the last decision. That's an unshare in shared mode, or the first
+//  write to a "fresh" deep copy in eager mode. With the threads deciding in
+//  turn, that's about a window's worth of copies. The site deep-copies from
+//  then on if that's more than the break-even ratio for their average length
+//  (see EagerPercent), which is measured on the machine it runs on rather
+//  than guessed. The shared site counters are updated without interlocked
+//  ops; a lost update under contention only delays a decision.
+//
+//  Unlike COW_AtomicInt2, refs is checked with an acquire load rather than
+//  an interlocked op. A String that sees refs == 1 (or unshareable) is the
+//  only holder, and nobody else can share it except by copying this very
+//  String; the acquire orders its reads and its delete after the other
+//  holders' releasing decrements, as COW_Ordered's Orders do. A stale count
+//  above 1 just takes the unshare path, which already copes with the other
+//  holders having gone. Only a unique holder ever makes a buffer
+//  unshareable, so a copy can't miss that either. That keeps a deep-copied
+//  buffer, which is never shared, as cheap to append to and destroy as
+//  Plain's.
+//
+//==============================================================================
+
+  namespace Adaptive {
+
+    const long nAdaptiveWindow = 256;   // copies per decision
+    const long nAdaptiveSlack  = 10;    // percent, see Decide
+    const int  nCalibrateLoops = 20000;
+
+    struct AdaptiveSite {
+        explicit AdaptiveSite( const char* n )
+          : name(n), mutated(0), eager(0), switches(0) {
+          for( int i = 0; i < ThreadSlot::nMaxThreads; ++i ) {
+            countdowns[i].left = nAdaptiveWindow;
+          }
+        }
+
+        const char*   name;
+        volatile long mutated;   // since the last decision, on any thread
+        volatile long eager;     // 1 to deep-copy, 0 to share
+        volatile long switches;  // mode changes so far
+
+        struct alignas(64) Countdown {
+            long left;           // this thread's copies to go until it decides
+        };
+        Countdown countdowns[ThreadSlot::nMaxThreads];
+    };
+
+    //  A shared copy costs an interlocked increment and decrement, 2A, plus a
+    //  deep copy D if it's mutated. An eager copy always costs D. So sharing
+    //  pays while fewer than 1 - 2A/D of the copies are mutated. A, and D as
+    //  a function of the length, are measured (in __rdtsc ticks, the best of
+    //  three tries) by main, before it times anything.
+    //
+    struct AdaptiveCosts {
+        double atomicOp;
+        double copyBase;         // new[], memcpy and delete[] of nothing
+        double copyPerByte;
+    };
+
+    inline double CalibrateCopy( size_t len ) {
+      static char* volatile escape;   // so the new[] can't be optimized away
+      char   src[1024] = { 0 };
+      double best = 1e30;
+      for( int k = 0; k < 3; ++k ) {
+        unsigned long long t = __rdtsc();
+        for( int i = 0; i < nCalibrateLoops; ++i ) {
+          char* p = new char[ len ];
+          memcpy( p, src, len );
+          escape = p;
+          delete[] p;
+        }
+        best = min( best, static_cast<double>( __rdtsc() - t ) / nCalibrateLoops );
+      }
+      return best;
+    }
+
+    inline AdaptiveCosts Calibrate() {
+      AdaptiveCosts c;
+      long   refs = 1;
+      double best = 1e30;
+      for( int k = 0; k < 3; ++k ) {
+        unsigned long long t = __rdtsc();
+        for( int i = 0; i < nCalibrateLoops; ++i ) {
+          IntAtomicIncrement( refs );
+          IntAtomicDecrement( refs );
+        }
+        best = min( best, static_cast<double>( __rdtsc() - t ) / ( 2 * nCalibrateLoops ) );
+      }
+      c.atomicOp    = best;
+      double small  = CalibrateCopy( 16 );
+      double large  = CalibrateCopy( 1024 );
+      c.copyPerByte = max( 0.0, ( large - small ) / ( 1024 - 16 ) );
+      c.copyBase    = max( 0.0, small - 16 * c.copyPerByte );
+      return c;
+    }
+
+    inline const AdaptiveCosts& Costs() {
+      static const AdaptiveCosts c = Calibrate();
+      return c;
+    }
+
+    //  The mutated percentage at and above which deep copies of len chars
+    //  are cheaper than sharing.
+    //
+    inline long EagerPercent( double len ) {
+      const AdaptiveCosts& c = Costs();
+      double d = c.copyBase + len * c.copyPerByte;
+      return d > 0 ? static_cast<long>( max( 0.0, 100 * ( 1 - 2 * c.atomicOp / d ) ) ) : 100;
+    }
+
+    //  Once a window, with the length of the copy that ended it standing in
+    //  for them all. Goes eager at EagerPercent, and back to sharing only
+    //  nAdaptiveSlack below that, so that it doesn't flap when the ratio is
+    //  right at it.
+    //
+    __declspec(noinline) inline void Decide( AdaptiveSite& site, size_t len ) {
+      long percent = site.mutated * 100 / nAdaptiveWindow;
+      long eagerAt = EagerPercent( static_cast<double>( len ) );
+      long eager   = percent >= eagerAt
+                  || ( site.eager && percent >= eagerAt - nAdaptiveSlack );
+      if( eager != site.eager ) {
+        site.eager = eager;
+        ++site.switches;
+      }
+      site.mutated = 0;
+    }
+
+    struct StringBuf {
+        size_t        len;
+        size_t        used;
+        atomic<long>  refs;
+        long          fresh;     // a deep copy that hasn't been written yet
+        AdaptiveSite* site;
+    };
+
+    template<class I>
+    class BasicString {
+    public:
+        BasicString();
+        explicit BasicString( AdaptiveSite& );
+       ~BasicString();
+        BasicString( const BasicString& );
+        void   Swap( BasicString& ) throw();
+        void   Clear();
+        void   Append( char );
+        size_t Length() const;
+        char&  operator[](size_t);
+        char   At(size_t) const;     // read-only access, stays shareable
+
+        static AdaptiveSite& DefaultSite();
+        static Stats stats;
+
+    private:
+        static char* NewData( AdaptiveSite& site );
+        static void  Copied( AdaptiveSite& site, size_t len );
+        static void  Mutated( AdaptiveSite& site );
+        char* Clone( char* olddata, size_t n = 0 );
+        void  Reserve( size_t n );
+        void  Grow( size_t n );
+        void  EnsureUnique( size_t n );
+        void  Unshare( size_t n );
+        void  EnsureUnshareable( size_t n );
+        char* data_;
+    };
+
+    typedef BasicString<NoInstr>     String;
+    typedef BasicString<CountInstr>  CountedString;
+    typedef BasicString<TraceInstr>  TracedString;
+    typedef BasicString<SampleInstr> SampledString;
+
+    template<class I> Stats BasicString<I>::stats;
+
+    //  LEN, USED, REFS and BUF as in COW_AtomicInt2, on this StringBuf.
+    //
+    #undef  LEN
+    #undef  USED
+    #undef  REFS
+    #undef  BUF
+    #define LEN(x)   (((StringBuf*)(x))->len)
+    #define USED(x)  (((StringBuf*)(x))->used)
+    #define REFS(x)  (((StringBuf*)(x))->refs)
+    #define BUF(x)   ((x) + sizeof(StringBuf))
+    #define FRESH(x) (((StringBuf*)(x))->fresh)
+    #define SITE(x)  (((StringBuf*)(x))->site)
+
+    template<class I>
+    inline AdaptiveSite& BasicString<I>::DefaultSite() {
+      static AdaptiveSite site( "default" );
+      return site;
+    }
+
+    template<class I>
+    inline char* BasicString<I>::NewData( AdaptiveSite& site ) {
+      char* data = ( I::OnAlloc( stats, sizeof(StringBuf) ), new char[ sizeof(StringBuf) ] );
+      LEN(data)   = 0;
+      USED(data)  = 0;
+      new( &REFS(data) ) atomic<long>( 1 );
+      FRESH(data) = 0;
+      SITE(data)  = &site;
+      return data;
+    }
+
+    //  Counts the copy against this thread's window, and decides when the
+    //  window is full.
+    //
+    template<class I>
+    inline void BasicString<I>::Copied( AdaptiveSite& site, size_t len ) {
+      long& left = site.countdowns[ ThreadSlot::Get() ].left;
+      if( --left <= 0 ) {
+        left = nAdaptiveWindow;
+        Decide( site, len );
+      }
+    }
+
+    template<class I>
+    inline void BasicString<I>::Mutated( AdaptiveSite& site ) {
+      ++site.mutated;
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString() : data_( NewData( DefaultSite() ) ) { }
+
+    template<class I>
+    inline BasicString<I>::BasicString( AdaptiveSite& site ) : data_( NewData( site ) ) { }
+
+    template<class I>
+    inline BasicString<I>::~BasicString() {
+      if( REFS(data_).load( memory_order_acquire ) <= 1 || REFS(data_).fetch_sub( 1 ) <= 1 ) {
+        I::OnFree( stats, LEN(data_) );
+        delete[] data_;
+      }
+    }
+
+    template<class I>
+    inline BasicString<I>::BasicString( const BasicString& other )
+    {
+      AdaptiveSite& site = *SITE(other.data_);
+      Copied( site, USED(other.data_) );
+      if( !site.eager && REFS(other.data_).load( memory_order_acquire ) > 0 ) {
+        data_ = other.data_;
+        REFS(data_).fetch_add( 1 );
+        I::OnShare( stats );
+      }
+      else {
+        data_ = Clone( other.data_ );
+        FRESH(data_) = 1;
+        I::OnDeepCopy( stats, USED(data_) );
+      }
+      I::OnCopy( stats );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Swap( BasicString& other ) throw() {
+      swap( data_, other.data_ );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Clear() {
+      BasicString tmp( *SITE(data_) );
+      Swap( tmp );
+    }
+
+    template<class I>
+    inline void BasicString<I>::Append( char c ) {
+      EnsureUnique( USED(data_)+1 );
+      BUF(data_)[USED(data_)++] = c;
+    }
+
+    template<class I>
+    inline size_t BasicString<I>::Length() const {
+      return USED(data_);
+    }
+
+    template<class I>
+    inline char& BasicString<I>::operator[]( size_t n ) {
+      EnsureUnshareable( LEN(data_) );
+      return *(BUF(data_)+n);
+    }
+
+    template<class I>
+    inline char BasicString<I>::At( size_t n ) const {
+      return *(BUF(data_)+n);
+    }
+
+    //  Unlike COW_AtomicInt2's, only grows when asked to (n > len), so a deep
+    //  copy is exactly as big as the original, like Plain's. As there, only
+    //  the characters are copied, not the atomic refs.
+    //
+    template<class I>
+    COLD char* BasicString<I>::Clone( char* data, size_t n ) {
+      size_t needed = n > LEN(data) ? static_cast<size_t>(max(LEN(data)*1.5, static_cast<double>(n)))
+                                    : LEN(data);
+
+      size_t newlen = needed ? 4 * ((needed-1)/4 + 1) : 0;
+      char*  newdata = ( I::OnAlloc( stats, sizeof(StringBuf) + newlen ), new char[ sizeof(StringBuf) + newlen ] );
+      memcpy( BUF(newdata), BUF(data), USED(data) );
+      LEN(newdata)   = newlen;
+      USED(newdata)  = USED(data);
+      new( &REFS(newdata) ) atomic<long>( 1 );
+      FRESH(newdata) = 0;
+      SITE(newdata)  = SITE(data);
+      return newdata;
+    }
+
+    template<class I>
+    inline void BasicString<I>::Reserve( size_t n ) {
+      if( UNLIKELY( LEN(data_) < n ) ) {
+        Grow( n );
+      }
+    }
+
+    template<class I>
+    COLD void BasicString<I>::Grow( size_t n ) {
+      char* newdata = Clone( data_, n );
+      I::OnGrow( stats, USED(data_) );
+      delete[] data_;
+      data_ = newdata;
+    }
+
+    template<class I>
+    inline void BasicString<I>::EnsureUnique( size_t n ) {
+      I::OnRefsRead( stats );
+      if( UNLIKELY( REFS(data_).load( memory_order_acquire ) > 1 ) ) {
+        Unshare( n );
+      }
+      else {
+        if( FRESH(data_) ) {
+          Mutated( *SITE(data_) );
+          FRESH(data_) = 0;
+        }
+        Reserve( n );
+        REFS(data_).store( 1, memory_order_relaxed ); // shareable again
+      }
+    }
+
+    template<class I>
+    COLD void BasicString<I>::Unshare( size_t n ) {
+      Mutated( *SITE(data_) );
+      I::OnUnshare( stats );
+      char* newdata = Clone( data_, n );
+      I::OnDeepCopy( stats, USED(data_) );
+      if( REFS(data_).fetch_sub( 1 ) <= 1 ) {
+        delete[] newdata;                             // just in case two threads
+        REFS(data_).store( 1, memory_order_relaxed ); //  are trying this at once
+      }
+      else {                                          // now all the real work is
+        data_ = newdata;                              //  done, so take ownership
+      }
+    }
+
+    template<class I>
+    inline void BasicString<I>::EnsureUnshareable( size_t n ) {
+      EnsureUnique( n );
+      REFS(data_).store( -1, memory_order_relaxed );
+      I::OnUnshareable( stats );
+    }
+
+  }
+
+
+//==============================================================================
+//
+//  Immutable sharing: shared_ptr<const std::string>, with the copy made by
+//       hand before a mutation, the way it's usually done outside of string
+//       classes. The code is shared in shared-ptr-test.h; these differ only
+//       in how the string is allocated:
+//
+//       SharedPtr_Make  make_shared, one allocation for the control block
+//                       and the std::string together
+//       SharedPtr_New   shared_ptr( new string ), two allocations
+//
+//       Either way the reference count is the shared_ptr's, so compare with
+//       COW_AtomicInt2, whose count is inside its own buffer.
+//
+//==============================================================================
+
+  namespace SharedPtr_Make {
+
+    #undef  MAKE_STRING
+    #define MAKE_STRING( x )  make_shared<string>( x )
+    #include "shared-ptr-test.h" //****************************************************
+
+  }
+
+  namespace SharedPtr_New {
+
+    #undef  MAKE_STRING
+    #define MAKE_STRING( x )  shared_ptr<string>( new string( x ) )
+    #include "shared-ptr-test.h" //****************************************************
+
+  }
+
+
+//==============================================================================
+//
+//  Test harness.
+//
+//==============================================================================
+
+ofstream out( "test.out" ); // to ensure there's a 'counter' side-effect
+
+inline void PrintCounts( const Counts& c )
+{
+    cout << "  copies:"   << setw(8)  << c.copies
+         << "  allocs:"   << setw(8)  << c.allocs
+         << "  deep:"     << setw(8)  << c.deepCopies
+         << "  unshares:" << setw(8)  << c.unshares
+         << "  grows:"    << setw(7)  << c.grows
+         << "  bytes:"    << setw(10) << c.bytesCopied
+         << "  refs reads:" << setw(8) << c.refsReads;
+}
+
+//  RecycleCache's share of the allocations it was asked for, and the heap
+//  calls that were still made (see TEST_RECYCLE).
+//
+inline void PrintRecycled( const RecycleCounts& c )
+{
+    long long asked = c.hits + c.misses;
+    cout << "  recycled:" << setw(5) << fixed << setprecision(1)
+         << ( asked ? 100.0 * c.hits / asked : 0.0 ) << "%"
+         << "  heap calls:" << setw(8) << c.misses + c.released;
+}
+
+//  One cycle of the selected test (see the TEST_xxx defines at the top) on s,
+//  which Test has initialized to length l. i is the outer loop count and c the
+//  inner loop's character. Test runs it 25 times per outer loop; the
+//  multi-threaded tests below run it on each thread's own copy of a string.
+//
+template<class S>
+inline void TestStep( S& s, long i, char c, long l, long& counter )
+{
+    UNREFERENCED_PARAMETER(s);
+    UNREFERENCED_PARAMETER(i);
+    UNREFERENCED_PARAMETER(c);
+    UNREFERENCED_PARAMETER(l);
+    UNREFERENCED_PARAMETER(counter);
+
+#if defined TEST_CONST_COPY
+    //  Simple const copy (cost: copy + destruct)
+    S s2( s );
+#elif defined TEST_APPEND
+    //  Simple appending
+    if( s.Length() > static_cast<size_t>(l) )
+    {
+        s.Clear();
+    }
+    s.Append( c );
+#elif defined TEST_OPERATOR
+    //  Simple nonmutating access
+    counter += s[0];
+#elif defined TEST_MUTATING_COPY_2A
+    //  33% of copies are const (cost: copy ctor + dtor),
+    //  rest are modified once (cost: copy ctor + deep copy +
+    //                                Append/op[] + dtor)
+    S s2( s );
+    if( i % 3 == 0 ) {
+      counter += s2[0];
+    }
+    else if( i % 3 == 1 ) {
+      s2.Append( c );
+    }
+#elif defined TEST_MUTATING_COPY_2B
+    //  50% of copies are const (cost: copy ctor + dtor),
+    //  rest are modified thrice (cost: copy ctor + deep copy +
+    //                                  3*Append/op[] + dtor)
+    S s2( s );
+    if( i % 4 == 0 ) {
+      counter += s2[0];
+      counter += s2[1];
+      counter += s2[2];
+    }
+    else if( i % 4 == 1 ) {
+      s2.Append( c );
+      s2.Append( c );
+      s2.Append( c );
+    }
+#endif
+}
+
+//  Never inlined into main, so that its loop (with all of S it uses inlined
+//  into it) is one function per S, for codesize.py to find.
+//
+template<class S>
+__declspec(noinline) int Test( S& s, long n, long l )
+{
+    long i = 0, counter = 0;
+    for( i = 0; i < l; ++i )    // initialize s to length l (for copying tests)
+    {
+        s.Append( 'X' );
+    }
+
+    S::stats.Reset();
+
+    n /= 25;    // the inner loop has 25 cycles per outer loop, so this will
+                //  give us the right number of iterations.
+    Timer t;    // *** start timing
+
+    for( i = 0; i < n; ++i )
+    {
+        for( char c = 'a'; c <= 'y'; ++c )
+        {
+            TestStep( s, i, c, l, counter );
+        }
+        LIVE_OPS( 25 );
+    }
+
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl; // don't let the compiler optimize
+                                            // away op[] and ruin our test case
+
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Read-heavy: n const copies of a string of length l, each read all the way
+//  through with At (bScan), or n reads with At of one character each from
+//  the same String (!bScan). Only for the Strings that have At.
+//
+//------------------------------------------------------------------------------
+
+template<class S>
+__declspec(noinline) int TestReadHeavy( long long n, long l, bool bScan )
+{
+    S s;
+    for( long i = 0; i < l; ++i )
+    {
+        s.Append( static_cast<char>( 'a' + i % 26 ) );
+    }
+
+    long counter = 0;
+    Timer t;    // *** start timing
+
+    if( bScan )
+    {
+        for( long long i = 0; i < n; ++i )
+        {
+            const S s2( s );
+            for( long k = 0; k < l; ++k )
+            {
+                counter += s2.At( k );
+            }
+        }
+    }
+    else if( l > 0 )
+    {
+        for( long long i = 0; i < n; ++i )
+        {
+            counter += s.At( static_cast<size_t>( i % l ) );
+        }
+    }
+
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Shared-string readers: nReaders threads each read the same String n times,
+//  while one more thread rewrites it (to a new string of the same length l)
+//  about once a millisecond until the readers are done.
+//
+//  None of the COW strings can be copied while another thread is modifying
+//  the very same String object (the copy reads other.data_, which Clear is
+//  busy replacing), so the generic ReadShared and WriteShared guard the
+//  shared object with a critical section, and the reader then sums a private
+//  copy that shares the buffer. SeqLock::String needs no guard; its overloads
+//  read and write the shared object directly. Nor do the SharedPtr strings,
+//  which share a SharedString instead (their S::Shared, see SharedOf): their
+//  overloads (in shared-ptr-test.h) take the reader's copy with an atomic
+//  load and swap the writer's new string in with an atomic store.
+//
+//------------------------------------------------------------------------------
+
+//  What TestSharedReaders' threads share: S itself, unless it names another
+//  type as its Shared.
+//
+template<class T> struct VoidOf { typedef void Type; };
+
+template<class S, class = void>
+struct SharedOf { typedef S Type; };
+
+template<class S>
+struct SharedOf<S, typename VoidOf<typename S::Shared>::Type> { typedef typename S::Shared Type; };
+
+template<class S>
+long ReadShared( S& shared, CriticalSection& cs, char*, size_t )
+{
+    Lock<CriticalSection> lock( cs );
+    S snap( shared );
+    lock.Unlock();
+
+    long sum = 0;
+    for( size_t i = 0, len = snap.Length(); i < len; ++i )
+    {
+        sum += snap.At( i );
+    }
+    return sum;
+}
+
+template<class S>
+void WriteShared( S& shared, CriticalSection& cs, const char* p, size_t n )
+{
+    Lock<CriticalSection> lock( cs );
+    shared.Clear();
+    for( size_t i = 0; i < n; ++i )
+    {
+        shared.Append( p[i] );
+    }
+}
+
+template<class I>
+inline long ReadShared( SeqLock::BasicString<I>& shared, CriticalSection&,
+                        char* scratch, size_t n )
+{
+    size_t len = min( shared.Read( scratch, n ), n );
+
+    long sum = 0;
+    for( size_t i = 0; i < len; ++i )
+    {
+        sum += scratch[i];
+    }
+    return sum;
+}
+
+template<class I>
+inline void WriteShared( SeqLock::BasicString<I>& shared, CriticalSection&,
+                         const char* p, size_t n )
+{
+    shared.Assign( p, n );
+}
+
+template<class S>
+struct SharedReader
+{
+    typename SharedOf<S>::Type* shared;
+    CriticalSection* cs;
+    StartGate*       gate;
+    long             n;
+    vector<char>     scratch;
+    long             sum;
+
+    void Run()
+    {
+        gate->Wait();
+        for( long i = 0; i < n; ++i )
+        {
+            sum += ReadShared( *shared, *cs, &scratch[0], scratch.size() );
+            LIVE_OPS( 1 );
+        }
+    }
+};
+
+template<class S>
+struct SharedWriter
+{
+    typename SharedOf<S>::Type* shared;
+    CriticalSection* cs;
+    StartGate*       gate;
+    volatile long*   done;
+    vector<char>     scratch;
+    long             nWrites;
+
+    void Run()
+    {
+        gate->Wait();
+        for( char c = 'a'; !*done; c = ( c == 'y' ? 'a' : c+1 ) )
+        {
+            fill( scratch.begin(), scratch.end(), c );
+            WriteShared( *shared, *cs, &scratch[0], scratch.size() );
+            ++nWrites;
+            Sleep( 1 );
+        }
+    }
+};
+
+template<class S>
+int TestSharedReaders( long n, long l, int nReaders, long& nWrites )
+{
+    CriticalSection cs;
+    StartGate       gate;
+    volatile long   done = 0;
+
+    typename SharedOf<S>::Type shared;
+    vector<char>               init( l+1, 'X' );
+    WriteShared( shared, cs, &init[0], l );
+
+    S::stats.Reset();
+
+    SharedReader<S> reader = { &shared, &cs, &gate, n, vector<char>( l ), 0 };
+    SharedWriter<S> writer = { &shared, &cs, &gate, &done, vector<char>( l ), 0 };
+    vector<SharedReader<S> > readers( nReaders, reader );
+
+    int ret = 0;
+    {
+        Thread<SharedWriter<S> > w( writer );
+        vector<Thread<SharedReader<S> >*> threads;
+        for( int i = 0; i < nReaders; ++i )
+        {
+            threads.push_back( new Thread<SharedReader<S> >( readers[i] ) );
+        }
+
+        Timer t;    // *** start timing
+        gate.Open();
+        for( int i = 0; i < nReaders; ++i )
+        {
+            delete threads[i];  // joins
+        }
+        ret = t.Elapsed();
+
+        done = 1;
+    }
+
+    long counter = 0;
+    for( int i = 0; i < nReaders; ++i )
+    {
+        counter += readers[i].sum;
+    }
+    out << "counter = " << counter << endl;
+
+    nWrites = writer.nWrites;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Lock microbenchmark: nThreads threads each acquire and release one shared
+//  lock n times, incrementing a shared counter while they hold it. With one
+//  thread that's the uncontended acquire/release latency; with more, it's how
+//  much lock handoff throughput survives contention.
+//
+//------------------------------------------------------------------------------
+
+template<class L>
+struct LockWorker
+{
+    L*         lock;
+    long*      shared;
+    StartGate* gate;
+    long       n;
+
+    void Run()
+    {
+        gate->Wait();
+        for( long i = 0; i < n; ++i )
+        {
+            Lock<L> l( *lock );
+            ++*shared;
+        }
+    }
+};
+
+template<class L>
+int TestLock( long n, int nThreads )
+{
+    L         lock;
+    long      shared = 0;
+    StartGate gate;
+
+    LockWorker<L> worker = { &lock, &shared, &gate, n };
+    vector<LockWorker<L> > workers( nThreads, worker );
+
+    int ret = 0;
+    {
+        vector<Thread<LockWorker<L> >*> threads;
+        for( int i = 0; i < nThreads; ++i )
+        {
+            threads.push_back( new Thread<LockWorker<L> >( workers[i] ) );
+        }
+
+        Timer t;    // *** start timing
+        gate.Open();
+        for( int i = 0; i < nThreads; ++i )
+        {
+            delete threads[i];  // joins
+        }
+        ret = t.Elapsed();
+    }
+
+    out << "counter = " << shared << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Timed multi-threaded runs of the selected test: nThreads threads each run
+//  TestStep for ms milliseconds, on their own copy of one shared source string
+//  (so with COW, all the threads start out sharing one buffer, and the copies
+//  TestStep makes hit that buffer's refs or lock from every thread at once).
+//  A worker times each batch of 25 cycles, the same batch Test's inner loop
+//  does, since timing single cycles would cost about as much as the cycles.
+//
+//  COW_Unsafe can't be run this way, of course.
+//
+//------------------------------------------------------------------------------
+
+struct TimedRun
+{
+    int              ms;
+    int              nThreads;
+    long long        ops;       // TestStep cycles, all threads
+    double           fairness;  // Jain's index of the per-thread op counts
+    LatencyHistogram latency;   // per batch of 25 cycles
+};
+
+template<class S>
+struct TimedWorker
+{
+    S*               src;
+    StartGate*       gate;
+    volatile long*   stop;
+    long             l;
+    long long        ops;
+    long             counter;
+    LatencyHistogram latency;
+
+    void Run()
+    {
+        S s( *src );
+        gate->Wait();
+        for( long i = 0; !*stop; ++i )
+        {
+            long long start = Timer::Ticks();
+            for( char c = 'a'; c <= 'y'; ++c )
+            {
+                TestStep( s, i, c, l, counter );
+            }
+            latency.Add( static_cast<long long>( (Timer::Ticks() - start) * Timer::NsPerTick() ) );
+            ops += 25;
+            LIVE_OPS( 25 );
+        }
+    }
+};
+
+const int nTimedRunMs = 1000;
+
+template<class S>
+void TestTimed( long l, int nThreads, int ms, TimedRun& r, bool bPin = false )
+{
+    S src;
+    for( long i = 0; i < l; ++i )
+    {
+        src.Append( 'X' );
+    }
+
+    S::stats.Reset();
+
+    StartGate     gate;
+    volatile long stop = 0;
+
+    TimedWorker<S> worker = { &src, &gate, &stop, l, 0, 0, LatencyHistogram() };
+    vector<TimedWorker<S> > workers( nThreads, worker );
+
+    {
+        vector<Thread<TimedWorker<S> >*> threads;
+        for( int i = 0; i < nThreads; ++i )
+        {
+            threads.push_back( new Thread<TimedWorker<S> >( workers[i], bPin ? i % HardwareThreads() : -1 ) );
+        }
+
+        Timer t;    // *** start timing
+        gate.Open();
+        Sleep( ms );
+        stop = 1;
+        for( int i = 0; i < nThreads; ++i )
+        {
+            delete threads[i];  // joins
+        }
+        r.ms = t.Elapsed();
+    }
+
+    long   counter = 0;
+    double sum = 0, sumSquares = 0;
+    r.nThreads = nThreads;
+    r.ops      = 0;
+    r.latency  = LatencyHistogram();
+    for( int i = 0; i < nThreads; ++i )
+    {
+        r.ops += workers[i].ops;
+        r.latency.Merge( workers[i].latency );
+        sum        += static_cast<double>( workers[i].ops );
+        sumSquares += static_cast<double>( workers[i].ops ) * workers[i].ops;
+        counter    += workers[i].counter;
+    }
+    r.fairness = sumSquares > 0 ? sum * sum / ( nThreads * sumSquares ) : 1.0;
+    out << "counter = " << counter << endl;
+}
+
+//  For starting a thread that does nothing, to get ThreadsStarted set.
+//
+struct IdleWorker
+{
+    void Run() { }
+};
+
+//  Formats a duration in ns as e.g. "850ns", "12.5us" or "3.1ms".
+//
+inline string FormatNs( long long ns )
+{
+    ostringstream os;
+    os << fixed << setprecision(1);
+    if( ns < 1000 )             os << ns << "ns";
+    else if( ns < 1000000 )     os << ns / 1e3 << "us";
+    else                        os << ns / 1e6 << "ms";
+    return os.str();
+}
+
+inline void PrintTimedRun( const char* name, const char* label, const TimedRun& r )
+{
+    cout << "  " << setw(15) << name << setw(5) << label << setw(4) << r.nThreads << " thr"
+         << "  Mops/s:"    << setw(7) << fixed << setprecision(2)
+                           << ( r.ms ? r.ops / ( r.ms * 1000.0 ) : 0.0 )
+         << "  fairness:"  << setw(6) << setprecision(3) << r.fairness
+         << "  p50:"       << setw(8) << FormatNs( r.latency.Percentile( 50 ) )
+         << "  p99:"       << setw(8) << FormatNs( r.latency.Percentile( 99 ) )
+         << "  p99.9:"     << setw(8) << FormatNs( r.latency.Percentile( 99.9 ) )
+         << "  max:"       << setw(8) << FormatNs( r.latency.Max() )
+         << endl;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Thread scaling: timed runs of the selected test at 1, 2, 4, ... threads up
+//  to nMaxThreads, one thread pinned per logical processor, reporting each
+//  count's throughput, its speedup over the single thread, and the parallel
+//  efficiency (speedup / threads; 1.0 is perfect scaling). Each row also goes
+//  to csv, for plotting.
+//
+//------------------------------------------------------------------------------
+
+template<class S>
+void TestScaling( const char* name, long l, int nMaxThreads, int run, ostream& csv )
+{
+    double base = 0;
+    for( int t = 1; ; t = min( t*2, nMaxThreads ) )
+    {
+        TimedRun r;
+        LIVE_RUN( "scaling", name, t, &S::stats );
+        TestTimed<S>( l, t, nTimedRunMs, r, true );
+
+        double opsPerSec = r.ms ? r.ops * 1000.0 / r.ms : 0.0;
+        if( t == 1 )
+        {
+            base = opsPerSec;
+        }
+        double speedup = base ? opsPerSec / base : 0.0;
+
+        cout << "  " << setw(15) << name << "  threads:" << setw(4) << t
+             << "  Mops/s:"     << setw(8) << fixed << setprecision(2) << opsPerSec / 1e6
+             << "  speedup:"    << setw(6) << speedup
+             << "  efficiency:" << setw(5) << speedup / t
+             << endl;
+        csv << run << ',' << name << ',' << t << ',' << r.ms << ',' << r.ops << ','
+            << opsPerSec << ',' << speedup << ',' << speedup / t << endl;
+
+        if( t >= nMaxThreads )
+        {
+            break;
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Instrumentation cost: the same single-threaded test timed on String (no
+//  instrumentation at all), CountedString and TracedString, with the extra
+//  time each instrumented build takes over the uninstrumented one.
+//
+//------------------------------------------------------------------------------
+
+inline double Overhead( int ms, int msInstr )
+{
+    return ms ? 100.0 * ( msInstr - ms ) / ms : 0.0;
+}
+
+inline void PrintInstrCost( const char* name, int ms, int msCounted, int msTraced )
+{
+    cout << "  " << setw(15) << name
+         << "  none:"     << setw(6) << ms << "ms"
+         << "  counters:" << setw(6) << msCounted << "ms"
+                          << setw(7) << fixed << setprecision(1)
+                          << Overhead( ms, msCounted ) << "%"
+         << "  tracing:"  << setw(6) << msTraced << "ms"
+                          << setw(7) << Overhead( ms, msTraced ) << "%"
+         << endl;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Event traces: TestTraced runs the selected single-threaded test once on a
+//  TracedString, marking its fill, loop and teardown phases, for TraceLog to
+//  dump. AnalyzeTrace reads such a dump back (TEST_TRACE does this for each
+//  implementation it traces; "TestCowStrings -analyze file" does it for any
+//  file) and prints what each phase did, then the nBursts windows of
+//  nBurstWindowUs with the most deep copies, against the average window.
+//  Those are the bursts that an overall timing flattens out.
+//
+//------------------------------------------------------------------------------
+
+template<class S>
+void TestTraced( const char* name, long n, long l )
+{
+    string prefix( name );
+    long   i = 0, counter = 0;
+
+    TraceLog::Phase( ( prefix + ": fill" ).c_str() );
+    {
+        S s;
+        for( i = 0; i < l; ++i )
+        {
+            s.Append( 'X' );
+        }
+
+        TraceLog::Phase( ( prefix + ": loop" ).c_str() );
+        n /= 25;
+        for( i = 0; i < n; ++i )
+        {
+            for( char c = 'a'; c <= 'y'; ++c )
+            {
+                TestStep( s, i, c, l, counter );
+            }
+        }
+
+        TraceLog::Phase( ( prefix + ": teardown" ).c_str() );
+    }
+    out << "counter = " << counter << endl;
+}
+
+const char* const traceEventNames[nTraceEventTypes] =
+{
+    "copy", "share", "alloc", "deep", "unshare", "unshareable", "grow", "free", "phase"
+};
+
+const double nBurstWindowUs = 10;
+const int    nBursts        = 5;
+
+struct TracePhase
+{
+    const char*        name;
+    unsigned long long first, last;
+    long long          events[nTraceEventTypes];
+    long long          deepBytes;
+};
+
+struct TraceBurst
+{
+    unsigned long long window;
+    long               deepCopies;
+    int                phase;
+};
+
+inline bool EarlierEvent( const TraceEvent& a, const TraceEvent& b )
+{
+    return a.ticks < b.ticks;
+}
+
+inline bool BiggerBurst( const TraceBurst& a, const TraceBurst& b )
+{
+    return a.deepCopies > b.deepCopies;
+}
+
+//  Reads a whole trace, with the events in time order; false (after saying
+//  why) if it can't.
+//
+inline bool ReadTrace( const char* file, TraceFileHeader& h, vector<char>& names,
+                       vector<TraceEvent>& events )
+{
+    ifstream f( file, ios::binary );
+    if( !f.read( reinterpret_cast<char*>( &h ), sizeof(h) )
+        || memcmp( h.magic, "COWT", 4 ) != 0 || h.version != TraceLog::nVersion )
+    {
+        cout << "  " << file << ": not a trace file\n";
+        return false;
+    }
+
+    names.assign( h.nPhases * TraceLog::nMaxPhaseName + 1, 0 );
+    events.resize( h.nEvents );
+    f.read( &names[0], h.nPhases * TraceLog::nMaxPhaseName );
+    if( h.nEvents )
+    {
+        f.read( reinterpret_cast<char*>( &events[0] ), h.nEvents * sizeof(TraceEvent) );
+    }
+    if( !f || events.empty() )
+    {
+        cout << "  " << file << ": truncated or empty\n";
+        return false;
+    }
+    stable_sort( events.begin(), events.end(), EarlierEvent );
+    return true;
+}
+
+inline bool AnalyzeTrace( const char* file )
+{
+    TraceFileHeader    h;
+    vector<char>       names;
+    vector<TraceEvent> events;
+    if( !ReadTrace( file, h, names, events ) )
+    {
+        return false;
+    }
+
+    //  Phase 0 holds whatever came before the first marker; phase k+1 starts
+    //  at the marker for name k.
+    vector<TracePhase> phases( h.nPhases + 1 );
+    phases[0].name = "(no phase)";
+    for( unsigned int k = 0; k < h.nPhases; ++k )
+    {
+        phases[k+1].name = &names[ k * TraceLog::nMaxPhaseName ];
+    }
+
+    unsigned long long t0     = events.front().ticks;
+    unsigned long long window = static_cast<unsigned long long>( nBurstWindowUs * 1000 * h.ticksPerNs ) + 1;
+    vector<bool>       slots( ThreadSlot::nMaxThreads );
+    vector<TraceBurst> bursts;
+    long long          nDeep  = 0;
+    int                cur    = 0;
+    phases[0].first = t0;
+
+    for( size_t i = 0; i < events.size(); ++i )
+    {
+        const TraceEvent& e = events[i];
+        if( e.slot >= ThreadSlot::nMaxThreads )   // not from a TraceLog
+        {
+            continue;
+        }
+        slots[ e.slot ] = true;
+        if( e.type == evPhase && e.size < h.nPhases )
+        {
+            cur = e.size + 1;
+            phases[cur].first = e.ticks;
+        }
+        else if( e.type < nTraceEventTypes )
+        {
+            ++phases[cur].events[ e.type ];
+        }
+        phases[cur].last = e.ticks;
+
+        if( e.type == evDeepCopy )
+        {
+            phases[cur].deepBytes += e.size;
+            ++nDeep;
+            unsigned long long w = ( e.ticks - t0 ) / window;
+            if( bursts.empty() || bursts.back().window != w )
+            {
+                TraceBurst b = { w, 0, cur };
+                bursts.push_back( b );
+            }
+            ++bursts.back().deepCopies;
+        }
+    }
+
+    double nsPerTick = 1.0 / h.ticksPerNs;
+    cout << "  " << file << ": " << events.size() << " events from "
+         << count( slots.begin(), slots.end(), true ) << " thread(s) over "
+         << FormatNs( static_cast<long long>( ( events.back().ticks - t0 ) * nsPerTick ) ) << "\n";
+
+    for( size_t k = 0; k < phases.size(); ++k )
+    {
+        const TracePhase& ph = phases[k];
+        if( k == 0 && ph.last == 0 )
+        {
+            continue;       // nothing before the first marker
+        }
+        cout << "    " << left << setw(28) << ph.name << right
+             << setw(9) << FormatNs( static_cast<long long>( ( ph.last - ph.first ) * nsPerTick ) );
+        for( int t = 0; t < evPhase; ++t )
+        {
+            cout << "  " << traceEventNames[t] << ":" << ph.events[t];
+        }
+        cout << "  deep bytes:" << ph.deepBytes << "\n";
+    }
+
+    if( !bursts.empty() )
+    {
+        double nWindows = static_cast<double>( ( events.back().ticks - t0 ) / window + 1 );
+        double average  = nDeep / nWindows;
+        cout << "    deep copies per " << FormatNs( static_cast<long long>( nBurstWindowUs * 1000 ) )
+             << ": " << fixed << setprecision(2)
+             << average << " on average; busiest:\n";
+
+        size_t nTop = min( bursts.size(), static_cast<size_t>(nBursts) );
+        partial_sort( bursts.begin(), bursts.begin() + nTop, bursts.end(), BiggerBurst );
+        for( size_t k = 0; k < nTop; ++k )
+        {
+            const TraceBurst& b = bursts[k];
+            cout << "      at " << setw(9)
+                 << FormatNs( static_cast<long long>( b.window * window * nsPerTick ) )
+                 << setw(6) << b.deepCopies << " (" << setw(6) << setprecision(1)
+                 << b.deepCopies / average << "x)  in " << phases[ b.phase ].name << "\n";
+        }
+    }
+    return true;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Live monitor ("TestCowStrings -monitor"): waits for a benchmark built with
+//  TEST_LIVE to start publishing in its LiveStats segment, then prints a line
+//  for each of its updates, until it says it's done.
+//
+//------------------------------------------------------------------------------
+
+inline int Monitor()
+{
+    LiveStatsBlock b;
+    cout << "Waiting for a TestCowStrings run built with TEST_LIVE...\n" << flush;
+    while( !LiveStats::Read( b ) || b.done )    // none yet, or an old one
+    {
+        Sleep( 1000 );
+    }
+
+    long last = -1;
+    for( ;; )
+    {
+        LiveStats::Read( b );
+        if( b.publishes != last )
+        {
+            last = b.publishes;
+            cout << "  [" << b.pid << "] " << left << setw(16) << b.scenario
+                 << setw(16) << b.implementation << right
+                 << "  threads:"  << setw(4)  << b.threads
+                 << "  elapsed:"  << setw(8)  << b.elapsedMs << "ms"
+                 << "  ops:"      << setw(11) << b.ops
+                 << "  Mops/s:"   << setw(8)  << fixed << setprecision(2) << b.opsPerSec / 1e6
+                 << "  copies:"   << setw(10) << b.copies
+                 << "  allocs:"   << setw(10) << b.allocs
+                 << endl;
+        }
+        if( b.done )
+        {
+            cout << "  [" << b.pid << "] done.\n";
+            return 0;
+        }
+        Sleep( LiveStats::nPeriodMs );
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Sampling profiler: ProfiledWorkload stands in for an application with a
+//  few call sites that each use strings in their own way. It's timed on
+//  String and on SampledString, for the cost of sampling, and then the
+//  samples taken in the sampled run are reported per call site, scaled by
+//  StringProfiler::Rate() to estimated totals and ordered by deep-copied
+//  bytes plus allocated bytes.
+//
+//------------------------------------------------------------------------------
+
+template<class S>
+int ProfiledWorkload( long n, long l )
+{
+    S    s;
+    long i = 0, counter = 0;
+    for( i = 0; i < l; ++i )
+    {
+        s.Append( 'X' );
+    }
+
+    Timer t;
+    for( i = 0; i < n; ++i )
+    {
+        {
+            PROFILE_SITE( "LookupName" );       // read-only copy
+            S name( s );
+            counter += static_cast<long>( name.Length() );
+        }
+        if( i % 4 == 0 )
+        {
+            PROFILE_SITE( "NormalizeCase" );    // copy, then write in place
+            S norm( s );
+            norm[0] = 'x';
+            counter += norm[1];
+        }
+        if( i % 8 == 0 )
+        {
+            PROFILE_SITE( "AppendSuffix" );     // copy, then grow
+            S suffixed( s );
+            suffixed.Append( '!' );
+            counter += static_cast<long>( suffixed.Length() );
+        }
+        if( i % 16 == 0 )
+        {
+            PROFILE_SITE( "ForwardRequest" );   // copy of a local that dies next
+            S request( s );
+            S forwarded( request );
+            counter += static_cast<long>( forwarded.Length() );
+        }
+        if( i % 64 == 0 )
+        {
+            PROFILE_SITE( "BuildMessage" );     // built from scratch
+            S msg;
+            for( long k = 0; k < l; ++k )
+            {
+                msg.Append( static_cast<char>( 'a' + k % 26 ) );
+            }
+            counter += static_cast<long>( msg.Length() );
+        }
+    }
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+//  Sampling costs a lot less than the noise between two runs, so take the best
+//  of a few, interleaved; the report is for the last sampled run.
+//
+const int nProfileRuns = 3;
+
+void PrintProfile();
+
+template<class S, class SampledS>
+void TestProfiled( const char* name, long n, long l )
+{
+    int ms = (numeric_limits<int>::max)(), msSampled = ms;
+    for( int k = 0; k < nProfileRuns; ++k )
+    {
+        ms = min( ms, ProfiledWorkload<S>( n, l ) );
+        StringProfiler::Reset();
+        msSampled = min( msSampled, ProfiledWorkload<SampledS>( n, l ) );
+    }
+    cout << "  " << setw(15) << name
+         << "  none:"    << setw(6) << ms << "ms"
+         << "  sampled:" << setw(6) << msSampled << "ms"
+         << setw(7) << fixed << setprecision(1) << Overhead( ms, msSampled ) << "%\n";
+    PrintProfile();
+    cout << endl;
+}
+
+struct SiteProfile
+{
+    const char* site;
+    long long   samples[nTraceEventTypes];
+    long long   bytes[nTraceEventTypes];
+    long long   timed[nTraceEventTypes];
+    double      ticks[nTraceEventTypes];
+    double      maxTicks[nTraceEventTypes];
+
+    long long Cost() const { return bytes[evDeepCopy] + bytes[evAlloc]; }
+};
+
+inline bool CostlierSite( const SiteProfile& a, const SiteProfile& b )
+{
+    return a.Cost() > b.Cost();
+}
+
+void PrintProfile()
+{
+    vector<SiteProfile> sites;
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+        const StringProfiler::Table* t = StringProfiler::Get( i );
+        for( int k = 0; t && k < StringProfiler::nEntries; ++k )
+        {
+            const ProfileEntry& e = t->entries[k];
+            if( !e.site )
+            {
+                continue;
+            }
+            size_t j = 0;
+            while( j < sites.size() && strcmp( sites[j].site, e.site ) != 0 )
+            {
+                ++j;
+            }
+            if( j == sites.size() )
+            {
+                SiteProfile p = SiteProfile();
+                p.site = e.site;
+                sites.push_back( p );
+            }
+            SiteProfile& p = sites[j];
+            p.samples[e.type]  += e.samples;
+            p.bytes[e.type]    += e.bytes;
+            p.timed[e.type]    += e.timed;
+            p.ticks[e.type]    += static_cast<double>( e.ticks );
+            p.maxTicks[e.type]  = max( p.maxTicks[e.type], static_cast<double>( e.maxTicks ) );
+        }
+    }
+    sort( sites.begin(), sites.end(), CostlierSite );
+
+    long   rate      = StringProfiler::Rate();
+    double nsPerTick = 1.0 / TscClock::TicksPerNs();
+    for( size_t j = 0; j < sites.size(); ++j )
+    {
+        const SiteProfile& p = sites[j];
+        cout << "    " << left << setw(15) << p.site << right
+             << "  copies:"      << setw(9) << p.samples[evCopy] * rate
+             << "  deep:"        << setw(9) << p.samples[evDeepCopy] * rate
+             << "  deep bytes:"  << setw(11) << p.bytes[evDeepCopy] * rate
+             << "  allocs:"      << setw(9) << p.samples[evAlloc] * rate
+             << "  alloc bytes:" << setw(11) << p.bytes[evAlloc] * rate
+             << "  frees:"       << setw(9) << p.samples[evFree] * rate;
+        const int timedTypes[] = { evUnshare, evAlloc };
+        const char* timedNames[] = { "unshare", "grow" };
+        for( int k = 0; k < 2; ++k )
+        {
+            int t = timedTypes[k];
+            if( p.timed[t] )
+            {
+                cout << "  " << timedNames[k] << " avg/max:"
+                     << FormatNs( static_cast<long long>( p.ticks[t] / p.timed[t] * nsPerTick ) ) << "/"
+                     << FormatNs( static_cast<long long>( p.maxTicks[t] * nsPerTick ) );
+            }
+        }
+        cout << "\n";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Copy-usefulness analysis (TEST_USEFULNESS): ProfiledWorkload on Tracked
+//  Plain and StdString, whose copies report what they were good for to
+//  CopyUsefulness (see test.h). Every op[] counts as a write, since that's
+//  what a COW string has to assume too.
+//
+//------------------------------------------------------------------------------
+
+template<class S>
+class Tracked
+{
+public:
+    Tracked() : site_(0), bytes_(0), bMutated_(false), copySite_(0), copyBytes_(0) { }
+
+    Tracked( const Tracked& other )
+      : s_( other.s_ ),
+        site_( StringProfiler::CurrentSite() ? StringProfiler::CurrentSite() : "(no site)" ),
+        bytes_( other.s_.Length() ), bMutated_( false ), copySite_( 0 ), copyBytes_( 0 )
+    {
+        other.copySite_  = site_;   // only the latest copy could have been a move
+        other.copyBytes_ = bytes_;
+    }
+
+   ~Tracked()                       { Discard(); Retire(); }
+
+    void   Clear()                  { Discard(); Retire(); s_.Clear(); }
+    void   Append( char c )         { copySite_ = 0; bMutated_ = true; s_.Append( c ); }
+    size_t Length() const           { copySite_ = 0; return s_.Length(); }
+    char&  operator[]( size_t n )   { copySite_ = 0; bMutated_ = true; return s_[n]; }
+
+private:
+    Tracked& operator=( const Tracked& );
+
+    //  Our value is going away; if we were last copied since anyone looked
+    //  at us, that copy could have taken it instead.
+    void Discard()
+    {
+        if( copySite_ )
+        {
+            CopyUsefulness::Movable( copySite_, copyBytes_ );
+            copySite_ = 0;
+        }
+    }
+
+    //  We stop being a copy (after a Clear we're a string of our own).
+    void Retire()
+    {
+        if( site_ )
+        {
+            CopyUsefulness::Copy( site_, bytes_, bMutated_ );
+            site_ = 0;
+        }
+    }
+
+    S                   s_;
+    const char*         site_;      // where we were copied, or 0 if we weren't
+    size_t              bytes_;
+    bool                bMutated_;
+    mutable const char* copySite_;  // where we were last copied, until touched
+    mutable size_t      copyBytes_;
+};
+
+inline bool MoreWasted( const UsefulnessEntry& a, const UsefulnessEntry& b )
+{
+    return a.wastedBytes + a.movableBytes > b.wastedBytes + b.movableBytes;
+}
+
+//  Sites ordered by the deep-copied bytes that sharing or moves would have
+//  saved. Moves and sharing overlap (a copy that is moved needn't be shared)
+//  so the two columns don't add up.
+//
+inline void PrintUsefulness()
+{
+    vector<UsefulnessEntry> sites;
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+        const CopyUsefulness::Table* t = CopyUsefulness::Get( i );
+        for( int k = 0; t && k < CopyUsefulness::nEntries; ++k )
+        {
+            const UsefulnessEntry& e = t->entries[k];
+            if( !e.site )
+            {
+                continue;
+            }
+            size_t j = 0;
+            while( j < sites.size() && strcmp( sites[j].site, e.site ) != 0 )
+            {
+                ++j;
+            }
+            if( j == sites.size() )
+            {
+                UsefulnessEntry u = UsefulnessEntry();
+                u.site = e.site;
+                sites.push_back( u );
+            }
+            UsefulnessEntry& u = sites[j];
+            u.copies       += e.copies;
+            u.mutated      += e.mutated;
+            u.bytes        += e.bytes;
+            u.wastedBytes  += e.wastedBytes;
+            u.movable      += e.movable;
+            u.movableBytes += e.movableBytes;
+        }
+    }
+    sort( sites.begin(), sites.end(), MoreWasted );
+
+    for( size_t j = 0; j < sites.size(); ++j )
+    {
+        const UsefulnessEntry& u = sites[j];
+        double copies = static_cast<double>( max( u.copies, 1LL ) );
+        cout << "    " << left << setw(15) << u.site << right
+             << "  copies:"    << setw(9) << u.copies
+             << "  wasted:"    << setw(6) << fixed << setprecision(1)
+             << ( u.copies - u.mutated ) * 100 / copies << "%"
+             << "  movable:"   << setw(6) << u.movable * 100 / copies << "%"
+             << "  deep bytes:"       << setw(11) << u.bytes
+             << "  COW would save:"   << setw(11) << u.wastedBytes
+             << "  moves would save:" << setw(11) << u.movableBytes << "\n";
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Mutation-ratio sweep (TEST_MUTATION_SWEEP): n copies of one string of
+//  length l, pct percent of which are then mutated (alternately by Append and
+//  by op[]) and the rest only read. Mutated copies are spread evenly over
+//  every 100 copies, so Adaptive sees the same ratio in every window.
+//
+//------------------------------------------------------------------------------
+
+const int nSweepStep = 10;  // percent
+
+template<class S>
+int TestMutationRatio( long n, long l, int pct )
+{
+    S    s;
+    long i = 0, counter = 0;
+    for( i = 0; i < l; ++i )
+    {
+        s.Append( 'X' );
+    }
+
+    Timer t;
+    for( i = 0; i < n; ++i )
+    {
+        S s2( s );
+        if( ( i % 100 ) * 37 % 100 < pct )
+        {
+            if( i & 1 )
+            {
+                s2.Append( 'a' );
+            }
+            else
+            {
+                s2[0] = 'a';
+            }
+        }
+        else
+        {
+            counter += static_cast<long>( s2.Length() );
+        }
+    }
+
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Copy capacity (TEST_COPY_CAPACITY), on Plain with copy capacity policy C:
+//  n copies of a string grown to length l by Append, each then destroyed, and
+//  then n more, each followed by k Appends. The counted run gives the grows
+//  those Appends needed. TestBuild builds n strings by l Appends, with or
+//  without a capacity hint of l.
+//
+//------------------------------------------------------------------------------
+
+struct CopyCapacityRun
+{
+    size_t    bytes;        // capacity of each copy
+    int       msCopy;
+    int       msAppend;
+    double    growsPerCopy;
+};
+
+template<class C>
+void TestCopyCapacity( long n, long l, long k, CopyCapacityRun& r )
+{
+    typedef Plain::BasicString<NoInstr,    C> S;
+    typedef Plain::BasicString<CountInstr, C> CS;
+
+    S    s;
+    CS   cs;
+    long i = 0, j = 0, counter = 0;
+    for( i = 0; i < l; ++i )
+    {
+        s.Append( 'X' );
+        cs.Append( 'X' );
+    }
+
+    Timer t;
+    for( i = 0; i < n; ++i )
+    {
+        S s2( s );
+        counter += static_cast<long>( s2.Length() );
+    }
+    r.msCopy = t.Elapsed();
+
+    Timer t2;
+    for( i = 0; i < n; ++i )
+    {
+        S s2( s );
+        for( j = 0; j < k; ++j )
+        {
+            s2.Append( 'a' );
+        }
+        counter += static_cast<long>( s2.Length() );
+    }
+    r.msAppend = t2.Elapsed();
+
+    CS::stats.Reset();
+    for( i = 0; i < n; ++i )
+    {
+        CS s2( cs );
+        for( j = 0; j < k; ++j )
+        {
+            s2.Append( 'a' );
+        }
+    }
+    r.growsPerCopy = static_cast<double>( CS::stats.Total().grows ) / max( n, 1L );
+    r.bytes        = CS( cs ).Capacity();
+
+    out << "counter = " << counter << endl;
+}
+
+int TestBuild( long n, long l, bool bHint )
+{
+    long i = 0, j = 0, counter = 0;
+
+    Timer t;
+    for( i = 0; i < n; ++i )
+    {
+        Plain::String s = bHint ? Plain::String( l ) : Plain::String();
+        for( j = 0; j < l; ++j )
+        {
+            s.Append( 'X' );
+        }
+        counter += static_cast<long>( s.Length() );
+    }
+
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Function boundaries (TEST_FUNCTION_BOUNDARY): strings passed to and
+//  returned from functions that are never inlined, as across an API, rather
+//  than Test's local copies. Each scenario runs n times on a source string of
+//  length l:
+//
+//    return     S r = ReturnCopy( src )         a copy into a local, returned
+//    by value   TakeByValue( src )              a copy into the parameter
+//    by const&  TakeByRef( src )                nothing
+//    by rvalue  TakeByRvalue( S( src ) )        a copy, moved into the callee's
+//    chain      S r = PassOn( PassOn( src ) )   a copy, then moves out of
+//                                               parameters
+//
+//  Where a String has no move constructor (of those run here, COW_Unsafe
+//  and StdStringCow) a move is another copy. The counted run shows which
+//  it was.
+//
+//------------------------------------------------------------------------------
+
+enum BoundaryScenario { bndReturn, bndByValue, bndByRef, bndByRvalue, bndChain, nBoundaryScenarios };
+
+const char* const boundaryNames[nBoundaryScenarios] = { "return", "by value", "by const&", "by rvalue", "chain" };
+
+template<class S>
+__declspec(noinline) S ReturnCopy( const S& s )
+{
+    S r( s );
+    return r;
+}
+
+template<class S>
+__declspec(noinline) size_t TakeByValue( S s )
+{
+    return s.Length();
+}
+
+template<class S>
+__declspec(noinline) size_t TakeByRef( const S& s )
+{
+    return s.Length();
+}
+
+template<class S>
+__declspec(noinline) size_t TakeByRvalue( S&& s )
+{
+    S mine( std::move( s ) );
+    return mine.Length();
+}
+
+template<class S>
+__declspec(noinline) S PassOn( S s )
+{
+    return s;   // moved, not copied, out of a parameter
+}
+
+template<class S>
+int TestBoundary( long n, long l, int scenario )
+{
+    S    src;
+    long i = 0;
+    for( i = 0; i < l; ++i )
+    {
+        src.Append( 'X' );
+    }
+
+    S::stats.Reset();
+
+    size_t counter = 0;
+    Timer  t;   // *** start timing
+
+    switch( scenario )
+    {
+    case bndReturn:
+        for( i = 0; i < n; ++i )
+        {
+            S r = ReturnCopy( src );
+            counter += r.Length();
+        }
+        break;
+    case bndByValue:
+        for( i = 0; i < n; ++i )
+        {
+            counter += TakeByValue( src );
+        }
+        break;
+    case bndByRef:
+        for( i = 0; i < n; ++i )
+        {
+            counter += TakeByRef( src );
+        }
+        break;
+    case bndByRvalue:
+        for( i = 0; i < n; ++i )
+        {
+            counter += TakeByRvalue( S( src ) );
+        }
+        break;
+    case bndChain:
+        for( i = 0; i < n; ++i )
+        {
+            S r = PassOn( PassOn( src ) );
+            counter += r.Length();
+        }
+        break;
+    }
+
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Producer/consumer handoff (TEST_HANDOFF): half the threads (at least one)
+//  produce n strings of length l each and push them through one MpmcQueue
+//  (see test.h), and the others pop them, read them through with At and
+//  destroy them. How a producer puts a string in is the variant:
+//
+//    copy    builds a new string, pushes a copy and destroys its own, so a
+//            COW string's last reference is dropped on the consumer's thread
+//    move    builds a new string and moves it in (a copy, for Strings with
+//            no move constructor)
+//    share   pushes a copy of one string it built up front, so every COW
+//            buffer is shared between the producer and the consumers
+//
+//  The queue holds 1024 strings. Producers spin while it's full, consumers
+//  while it's empty. The time runs from opening the start gate until the
+//  last consumer is done.
+//
+//------------------------------------------------------------------------------
+
+enum HandoffVariant { hoCopy, hoMove, hoShare, nHandoffVariants };
+
+const char* const handoffNames[nHandoffVariants] = { "copy", "move", "share" };
+
+template<class S>
+struct Handoff
+{
+    Handoff( long n, long l, int variant, int nProducers )
+      : queue( 1024 ), n( n ), l( l ), variant( variant ), producersLeft( nProducers ) { }
+
+    MpmcQueue<S>  queue;
+    StartGate     gate;
+    long          n;
+    long          l;
+    int           variant;
+    volatile long producersLeft;
+};
+
+template<class S>
+struct HandoffProducer
+{
+    Handoff<S>* h;
+
+    void Run()
+    {
+        S    source;
+        long i = 0, j = 0;
+        for( j = 0; j < h->l; ++j )
+        {
+            source.Append( 'X' );
+        }
+
+        h->gate.Wait();
+        for( i = 0; i < h->n; ++i )
+        {
+            int spins = 0;
+            if( h->variant == hoShare )
+            {
+                while( !h->queue.Push( source ) )
+                {
+                    SpinWait( spins );
+                }
+                LIVE_OPS( 1 );
+                continue;
+            }
+
+            S s;
+            for( j = 0; j < h->l; ++j )
+            {
+                s.Append( 'X' );
+            }
+            if( h->variant == hoCopy )
+            {
+                while( !h->queue.Push( s ) )
+                {
+                    SpinWait( spins );
+                }
+            }
+            else
+            {
+                while( !h->queue.Push( std::move( s ) ) )   // only moved once it's in
+                {
+                    SpinWait( spins );
+                }
+            }
+            LIVE_OPS( 1 );
+        }
+        InterlockedDecrement( &h->producersLeft );
+    }
+};
+
+template<class S>
+struct HandoffConsumer
+{
+    Handoff<S>* h;
+    long        items;
+    long        counter;
+
+    void operator()( S& s )
+    {
+        for( size_t k = 0; k < s.Length(); ++k )
+        {
+            counter += s.At( k );
+        }
+        ++items;
+    }
+
+    void Run()
+    {
+        h->gate.Wait();
+        int spins = 0;
+        for( ;; )
+        {
+            if( h->queue.Pop( *this ) )
+            {
+                spins = 0;
+            }
+            else if( h->producersLeft == 0 )
+            {
+                while( h->queue.Pop( *this ) )  // whatever was pushed after
+                {                               // the Pop above looked
+                }
+                break;
+            }
+            else
+            {
+                SpinWait( spins );
+            }
+        }
+    }
+};
+
+template<class S>
+int TestHandoff( long n, long l, int variant, int nThreads )
+{
+    int nProducers = max( nThreads / 2, 1 );
+    int nConsumers = max( nThreads - nProducers, 1 );
+
+    S::stats.Reset();
+
+    Handoff<S> h( n, l, variant, nProducers );
+
+    HandoffProducer<S> producer = { &h };
+    HandoffConsumer<S> consumer = { &h, 0, 0 };
+    vector<HandoffProducer<S> > producers( nProducers, producer );
+    vector<HandoffConsumer<S> > consumers( nConsumers, consumer );
+
+    int ret = 0;
+    {
+        vector<Thread<HandoffProducer<S> >*> pThreads;
+        vector<Thread<HandoffConsumer<S> >*> cThreads;
+        int i = 0;
+        for( i = 0; i < nProducers; ++i )
+        {
+            pThreads.push_back( new Thread<HandoffProducer<S> >( producers[i] ) );
+        }
+        for( i = 0; i < nConsumers; ++i )
+        {
+            cThreads.push_back( new Thread<HandoffConsumer<S> >( consumers[i] ) );
+        }
+
+        Timer t;    // *** start timing
+        h.gate.Open();
+        for( i = 0; i < nConsumers; ++i )
+        {
+            delete cThreads[i];     // joins
+        }
+        ret = t.Elapsed();
+        for( i = 0; i < nProducers; ++i )
+        {
+            delete pThreads[i];
+        }
+    }
+
+    long items = 0, counter = 0;
+    for( int i = 0; i < nConsumers; ++i )
+    {
+        items   += consumers[i].items;
+        counter += consumers[i].counter;
+    }
+    if( items != n * nProducers )
+    {
+        cout << "*** handoff lost strings: " << items << " of " << n * nProducers << endl;
+    }
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Coroutine pipeline (TEST_COROUTINE_PIPELINE): four C++20 coroutines on one
+//  thread, connected by Channels (see test.h), handle n strings of length l:
+//
+//    parse      cuts each string out of a line of 16 comma-separated fields
+//    transform  upper-cases it in place, with operator[]
+//    format     appends a newline
+//    emit       reads it through with At
+//
+//  Each stage sends what it made either as a copy or moved. A Send lets the
+//  next stage run before the sender resumes, so with copies the sender still
+//  holds its string across that suspension: a COW string's buffer is shared
+//  when transform writes to it and format appends to it, and both unshare.
+//  Moves leave nothing behind to share. AtlString isn't run, as it can't be
+//  written through operator[].
+//
+//------------------------------------------------------------------------------
+
+#if defined __cpp_impl_coroutine
+
+const long nPipelineFields = 16;
+
+template<class S>
+Stage Parse( const S& line, Channel<S>& out, long n, long l, bool bMove )
+{
+    for( long i = 0; i < n; ++i )
+    {
+        S    s;
+        long start = ( i % nPipelineFields ) * ( l+1 );
+        for( long j = 0; j < l; ++j )
+        {
+            s.Append( line.At( start+j ) );
+        }
+        if( bMove )
+        {
+            co_await out.Send( std::move( s ) );
+        }
+        else
+        {
+            co_await out.Send( s );
+        }
+    }
+    out.Close();
+}
+
+template<class S>
+Stage Transform( Channel<S>& in, Channel<S>& out, bool bMove )
+{
+    for( ;; )
+    {
+        std::optional<S> s = co_await in.Receive();
+        if( !s )
+        {
+            break;
+        }
+        for( size_t k = 0; k < s->Length(); ++k )
+        {
+            (*s)[k] = static_cast<char>( (*s)[k] - 'a' + 'A' );
+        }
+        if( bMove )
+        {
+            co_await out.Send( std::move( *s ) );
+        }
+        else
+        {
+            co_await out.Send( *s );
+        }
+    }
+    out.Close();
+}
+
+template<class S>
+Stage Format( Channel<S>& in, Channel<S>& out, bool bMove )
+{
+    for( ;; )
+    {
+        std::optional<S> s = co_await in.Receive();
+        if( !s )
+        {
+            break;
+        }
+        s->Append( '\n' );
+        if( bMove )
+        {
+            co_await out.Send( std::move( *s ) );
+        }
+        else
+        {
+            co_await out.Send( *s );
+        }
+    }
+    out.Close();
+}
+
+template<class S>
+Stage Emit( Channel<S>& in, long& counter )
+{
+    for( ;; )
+    {
+        std::optional<S> s = co_await in.Receive();
+        if( !s )
+        {
+            break;
+        }
+        for( size_t k = 0; k < s->Length(); ++k )
+        {
+            counter += s->At( k );
+        }
+    }
+}
+
+template<class S>
+int TestPipeline( long n, long l, bool bMove )
+{
+    S    line;
+    long i = 0;
+    for( long f = 0; f < nPipelineFields; ++f )
+    {
+        for( i = 0; i < l; ++i )
+        {
+            line.Append( static_cast<char>( 'a' + f ) );
+        }
+        line.Append( ',' );
+    }
+
+    S::stats.Reset();
+
+    long      counter = 0;
+    Scheduler scheduler;
+    Channel<S> parsed( scheduler ), transformed( scheduler ), formatted( scheduler );
+
+    Timer t;    // *** start timing
+    {
+        Stage parse     = Parse( line, parsed, n, l, bMove );
+        Stage transform = Transform( parsed, transformed, bMove );
+        Stage format    = Format( transformed, formatted, bMove );
+        Stage emit      = Emit( formatted, counter );
+        parse.Start( scheduler );
+        transform.Start( scheduler );
+        format.Start( scheduler );
+        emit.Start( scheduler );
+        scheduler.Run();
+        if( !emit.Done() )
+        {
+            cout << "*** pipeline stalled" << endl;
+        }
+    }
+    int ret = t.Elapsed();
+    out << "counter = " << counter << endl;
+    return ret;
+}
+
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+//  Batch processing (TEST_BATCH): a corpus of n records of length l, each a
+//  line of lower-case words, processed in parallel by StealingFor (see
+//  test.h) in grains of nBatchGrain records. For each record, a worker
+//
+//    copies      it out of the corpus, which all the workers share
+//    transforms  every other copy to upper case in place, with operator[]
+//    splits      the copy at the spaces into words, each a new String built
+//                with Append
+//    aggregates  the words, their lengths and a hash of their characters into
+//                its own totals, summed at the end
+//
+//  The records are drawn in turn from nBatchSources distinct strings rather
+//  than being n distinct ones: FastArena (test.h), which Plain_FastAlloc and
+//  the common-test.h Strings allocate from, looks for a free slot from the
+//  start, past every buffer the corpus holds, and a corpus of millions would
+//  make that scan the whole benchmark. The result is records/s on one thread
+//  and on all of them. AtlString isn't run, as it can't be written through
+//  operator[].
+//
+//------------------------------------------------------------------------------
+
+const long nBatchSources = 256;
+const long nBatchGrain   = 256;
+
+struct alignas(64) BatchTotals
+{
+    long long     words;
+    long long     chars;
+    unsigned long hash;
+};
+
+template<class S>
+struct BatchBody
+{
+    const S*             corpus;
+    vector<BatchTotals>* totals;
+
+    void operator()( int worker, long begin, long end )
+    {
+        BatchTotals& t = (*totals)[worker];
+        for( long i = begin; i < end; ++i )
+        {
+            S      record( corpus[ i % nBatchSources ] );
+            size_t len = record.Length();
+            size_t k = 0;
+            if( i % 2 == 0 )
+            {
+                for( k = 0; k < len; ++k )
+                {
+                    if( record.At( k ) != ' ' )
+                    {
+                        record[k] = static_cast<char>( record[k] - 'a' + 'A' );
+                    }
+                }
+            }
+
+            for( k = 0; k < len; ++k )
+            {
+                S word;
+                for( ; k < len && record.At( k ) != ' '; ++k )
+                {
+                    word.Append( record.At( k ) );
+                }
+                for( size_t c = 0; c < word.Length(); ++c )
+                {
+                    t.hash = t.hash * 31 + static_cast<unsigned char>( word.At( c ) );
+                }
+                t.chars += word.Length();
+                ++t.words;
+            }
+        }
+    }
+};
+
+struct BatchRun
+{
+    int  ms;
+    long steals;
+};
+
+template<class S>
+void TestBatch( long n, long l, int nThreads, BatchRun& r )
+{
+    S*   corpus = new S[nBatchSources];
+    long i = 0;
+    for( long j = 0; j < nBatchSources; ++j )
+    {
+        for( i = 0; i < l; ++i )
+        {
+            bool bSpace = i > 0 && ( i + j ) % 7 == 0;
+            corpus[j].Append( bSpace ? ' ' : static_cast<char>( 'a' + ( i*5 + j ) % 26 ) );
+        }
+    }
+
+    BatchTotals zero = { 0, 0, 0 };
+    vector<BatchTotals> totals( nThreads, zero );
+    BatchBody<S>        body = { corpus, &totals };
+
+    {
+        StealingFor<BatchBody<S> > pool( body, nThreads, nBatchGrain );
+        r.ms     = pool.Run( n );
+        r.steals = pool.Steals();
+    }
+
+    BatchTotals sum = zero;
+    for( int k = 0; k < nThreads; ++k )
+    {
+        sum.words += totals[k].words;
+        sum.chars += totals[k].chars;
+        sum.hash  ^= totals[k].hash;
+    }
+    out << "words = " << sum.words << ", chars = " << sum.chars << ", hash = " << sum.hash << endl;
+    delete[] corpus;
+}
+
+
+//------------------------------------------------------------------------------
+//
+//  Auto-tuner (TEST_TUNE): runs a workload, described on the command line or
+//  derived from a trace written by TEST_TRACE, on every candidate
+//  implementation, and recommends the fastest and the one that needs the
+//  least memory, with the margin to the runner-up in each case. The
+//  candidates are each COW variant (with each of the locks, for the
+//  lock-based ones), Plain on every combination of its copy capacity,
+//  growth, allocator and small-string policies, Plain_FastAlloc (Plain on
+//  FastArena), StdString, SeqLock, Adaptive and the SharedPtr strings.
+//
+//  A workload is a mix of four ops, each on a copy of one of nTuneSources
+//  source strings whose lengths are uniform over [minLen, maxLen]:
+//
+//    const   copy, read the length     write   copy, then write with op[]
+//    append  copy, then Append         build   Append a new string from scratch
+//
+//  e.g. "const=60,append=20,write=20,build=0,len=10-200,threads=4,ops=1000000"
+//  (ops is per thread). Every thread starts from its own copy of the sources,
+//  so COW variants begin with all their buffers shared between threads.
+//
+//  Speed is measured on the given number of threads. Memory is the peak of
+//  live heap bytes (see HeapCount, which also counts FastArena chunks) while
+//  a single thread builds its own sources and runs nTuneMemOps ops on them.
+//  Buffers kept by RecycleCache count as live.
+//  AtlString can't be a candidate, because CString has no writable
+//  operator[] (and allocates outside operator new). COW_Unsafe is only a
+//  candidate for single-threaded workloads.
+//
+//------------------------------------------------------------------------------
+
+#if defined TEST_TUNE
+
+enum TuneOp { tuneConst, tuneAppend, tuneWrite, tuneBuild, nTuneOps };
+
+const char* const tuneOpNames[nTuneOps] = { "const", "append", "write", "build" };
+
+const int  nTuneSources = 64;
+const int  nTuneOpTable = 4096;     // ops are drawn from this, a power of 2
+const long nTuneMemOps  = 100000;
+
+struct Workload
+{
+    int  mix[nTuneOps];     // relative weights
+    long minLen, maxLen;
+    int  threads;
+    long ops;               // per thread
+};
+
+//  Replaced for HeapCount. _msize is what the heap really set aside, which is
+//  what the memory runs should be charged.
+//
+__declspec(noinline) void* operator new( size_t n )
+{
+    void* p = malloc( n ? n : 1 );
+    if( !p )
+    {
+        throw bad_alloc();
+    }
+    HeapCount::Add( _msize( p ) );
+    return p;
+}
+
+__declspec(noinline) void operator delete( void* p ) throw()
+{
+    if( p )
+    {
+        HeapCount::Sub( _msize( p ) );
+        free( p );
+    }
+}
+
+void* operator new[]( size_t n )                    { return operator new( n ); }
+void  operator delete[]( void* p ) throw()          { operator delete( p ); }
+void  operator delete( void* p, size_t ) throw()    { operator delete( p ); }
+void  operator delete[]( void* p, size_t ) throw()  { operator delete( p ); }
+
+inline bool ParseWorkload( const string& desc, Workload& w )
+{
+    istringstream in( desc );
+    string        item;
+    while( getline( in, item, ',' ) )
+    {
+        size_t eq = item.find( '=' );
+        if( eq == string::npos )
+        {
+            return false;
+        }
+        string key = item.substr( 0, eq ), value = item.substr( eq+1 );
+        int    op  = 0;
+        while( op < nTuneOps && key != tuneOpNames[op] )
+        {
+            ++op;
+        }
+        if( op < nTuneOps )                 w.mix[op]  = atoi( value.c_str() );
+        else if( key == "threads" )         w.threads  = max( 1, atoi( value.c_str() ) );
+        else if( key == "ops" )             w.ops      = max( 1L, atol( value.c_str() ) );
+        else if( key == "len" )
+        {
+            size_t dash = value.find( '-' );
+            w.minLen = atol( value.c_str() );
+            w.maxLen = dash == string::npos ? w.minLen : atol( value.c_str() + dash + 1 );
+        }
+        else
+        {
+            return false;
+        }
+    }
+    w.minLen = max( w.minLen, 1L );     // tuneWrite needs a character to write
+    w.maxLen = max( w.minLen, w.maxLen );
+    return true;
+}
+
+//  From a trace: copies that were later unshared were mutated (marked
+//  unshareable first means op[], otherwise Append), the rest were const, and
+//  the deep copies give the range of lengths. A trace of a non-COW string has
+//  no unshares, so its copies all look const.
+//
+inline bool WorkloadFromTrace( const char* file, Workload& w )
+{
+    TraceFileHeader    h;
+    vector<char>       names;
+    vector<TraceEvent> events;
+    if( !ReadTrace( file, h, names, events ) )
+    {
+        return false;
+    }
+
+    long long    n[nTraceEventTypes] = { 0 };
+    unsigned int minLen = ~0u, maxLen = 0;
+    vector<bool> slots( ThreadSlot::nMaxThreads );
+    for( size_t i = 0; i < events.size(); ++i )
+    {
+        const TraceEvent& e = events[i];
+        if( e.slot >= ThreadSlot::nMaxThreads )   // not from a TraceLog
+        {
+            continue;
+        }
+        ++n[ e.type < nTraceEventTypes ? e.type : static_cast<unsigned short>( evPhase ) ];
+        slots[ e.slot ] = true;
+        if( e.type == evDeepCopy )
+        {
+            minLen = min( minLen, e.size );
+            maxLen = max( maxLen, e.size );
+        }
+    }
+
+    long long writes  = min( n[evUnshareable], n[evUnshare] );
+    long long appends = n[evUnshare] - writes;
+    long long total   = max( n[evCopy], 1LL );
+    w.mix[tuneWrite]  = static_cast<int>( 1000 * writes / total );
+    w.mix[tuneAppend] = static_cast<int>( 1000 * appends / total );
+    w.mix[tuneConst]  = static_cast<int>( 1000 * max( n[evCopy] - n[evUnshare], 0LL ) / total );
+    w.mix[tuneBuild]  = 0;
+    if( maxLen )
+    {
+        w.minLen = max( minLen, 1u );
+        w.maxLen = maxLen;
+    }
+    w.threads = static_cast<int>( max( static_cast<long>( count( slots.begin(), slots.end(), true ) ), 1L ) );
+    return true;
+}
+
+template<class S>
+struct TuneWorker
+{
+    const vector<S>*             sources;
+    const vector<unsigned char>* ops;
+    StartGate*                   gate;
+    long                         n;
+    long                         counter;
+
+    void Run()
+    {
+        vector<S> mine( *sources );
+        gate->Wait();
+        for( long i = 0; i < n; ++i )
+        {
+            const S& src = mine[ i % nTuneSources ];
+            switch( (*ops)[ i & (nTuneOpTable-1) ] )
+            {
+            case tuneConst:
+            {
+                S s( src );
+                counter += static_cast<long>( s.Length() );
+                break;
+            }
+            case tuneAppend:
+            {
+                S s( src );
+                s.Append( 'a' );
+                counter += static_cast<long>( s.Length() );
+                break;
+            }
+            case tuneWrite:
+            {
+                S s( src );
+                s[0] = 'w';
+                counter += s[0];
+                break;
+            }
+            default:
+            {
+                S s;
+                for( size_t k = 0, len = src.Length(); k < len; ++k )
+                {
+                    s.Append( 'b' );
+                }
+                counter += static_cast<long>( s.Length() );
+                break;
+            }
+            }
+        }
+    }
+};
+
+struct TuneResult
+{
+    const char* name;
+    double      mopsPerSec;
+    long long   peakBytes;
+};
+
+template<class S>
+void MakeSources( vector<S>& sources, const Workload& w )
+{
+    for( int i = 0; i < nTuneSources; ++i )
+    {
+        long len = w.minLen + ( w.maxLen - w.minLen ) * i / max( nTuneSources - 1, 1 );
+        for( long k = 0; k < len; ++k )
+        {
+            sources[i].Append( static_cast<char>( 'a' + k % 26 ) );
+        }
+    }
+}
+
+template<class S>
+void TuneCandidate( const char* name, const Workload& w, const vector<unsigned char>& ops,
+                    bool bThreadSafe, vector<TuneResult>& results )
+{
+    if( w.threads > 1 && !bThreadSafe )
+    {
+        return;
+    }
+
+    vector<S> sources( nTuneSources );
+    MakeSources( sources, w );
+
+    StartGate     gate;
+    TuneWorker<S> worker = { &sources, &ops, &gate, w.ops, 0 };
+    vector<TuneWorker<S> > workers( w.threads, worker );
+    int ms = 0;
+    {
+        vector<Thread<TuneWorker<S> >*> threads;
+        for( int t = 0; t < w.threads; ++t )
+        {
+            threads.push_back( new Thread<TuneWorker<S> >( workers[t] ) );
+        }
+        Sleep( 10 );        // let them all get to the gate
+        Timer timer;
+        gate.Open();
+        for( int t = 0; t < w.threads; ++t )
+        {
+            delete threads[t];
+        }
+        ms = timer.Elapsed();
+    }
+
+    long long peak = 0;
+    {
+        StartGate open;
+        open.Open();
+        RecycleCache::Drain();      // an earlier candidate's buffers aren't ours
+        HeapCount::Start();
+        {
+            vector<S> memSources( nTuneSources );
+            MakeSources( memSources, w );
+            TuneWorker<S> memWorker = { &memSources, &ops, &open, min( w.ops, nTuneMemOps ), 0 };
+            memWorker.Run();
+            worker.counter += memWorker.counter;
+        }
+        HeapCount::Stop();
+        peak = HeapCount::Peak();
+    }
+
+    for( int t = 0; t < w.threads; ++t )
+    {
+        worker.counter += workers[t].counter;
+    }
+    out << "counter = " << worker.counter << endl;
+
+    TuneResult r = { name, ms ? w.threads * ( w.ops / 1000.0 ) / ms : 0.0, peak };
+    results.push_back( r );
+    cout << "  " << setw(46) << name << "  Mops/s:" << setw(8) << fixed << setprecision(2) << r.mopsPerSec
+         << "  peak memory:" << setw(10) << peak << " bytes\n";
+}
+
+inline bool FasterResult( const TuneResult& a, const TuneResult& b )
+{
+    return a.mopsPerSec > b.mopsPerSec;
+}
+
+inline bool SmallerResult( const TuneResult& a, const TuneResult& b )
+{
+    return a.peakBytes < b.peakBytes;
+}
+
+inline int Tune( const char* arg )
+{
+    Workload w = { { 60, 20, 20, 0 }, 10, 200, HardwareThreads(), 1000000 };
+    string   desc( arg );
+    if( desc.size() > 4 && desc.substr( desc.size() - 4 ) == ".bin" )
+    {
+        if( !WorkloadFromTrace( arg, w ) )
+        {
+            return 1;
+        }
+    }
+    else if( !ParseWorkload( desc, w ) )
+    {
+        cout << "Usage: TestCowStrings [trace.bin | "
+                "const=N,append=N,write=N,build=N,len=MIN-MAX,threads=N,ops=N]\n";
+        return 1;
+    }
+
+    int totalMix = 0;
+    for( int op = 0; op < nTuneOps; ++op )
+    {
+        totalMix += max( w.mix[op], 0 );
+    }
+    if( !totalMix )
+    {
+        w.mix[tuneConst] = totalMix = 1;
+    }
+
+    //  The ops, in a fixed pseudo-random order with the requested proportions.
+    vector<unsigned char> ops( nTuneOpTable );
+    unsigned long seed = 2463534242UL;
+    for( int i = 0; i < nTuneOpTable; ++i )
+    {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        seed &= 0xFFFFFFFFUL;
+        int pick = static_cast<int>( seed % totalMix ), op = 0;
+        while( pick >= max( w.mix[op], 0 ) )
+        {
+            pick -= max( w.mix[op], 0 );
+            ++op;
+        }
+        ops[i] = static_cast<unsigned char>( op );
+    }
+
+    cout << "Workload:";
+    for( int op = 0; op < nTuneOps; ++op )
+    {
+        cout << " " << tuneOpNames[op] << "=" << w.mix[op];
+    }
+    cout << ", len=" << w.minLen << "-" << w.maxLen << ", threads=" << w.threads
+         << ", ops=" << w.ops << " per thread\n\n";
+
+    vector<TuneResult> results;
+
+    #define TUNE_CANDIDATE( TEST_NAME, bThreadSafe ) \
+        TuneCandidate<TEST_NAME::String>( #TEST_NAME, w, ops, bThreadSafe, results )
+
+    //  Plain on every combination of its policies, String's among them.
+    #define TUNE_PLAIN( C, G, A, nSso ) \
+        TuneCandidate<Plain::BasicString<NoInstr, Plain::C, Plain::G, Plain::A, nSso> >( \
+            "Plain<" #C "," #G "," #A "," #nSso ">", w, ops, true, results )
+    #define TUNE_PLAIN_SSO( C, G, A ) \
+        TUNE_PLAIN( C, G, A, 0 ); TUNE_PLAIN( C, G, A, 15 ); TUNE_PLAIN( C, G, A, 31 )
+    #define TUNE_PLAIN_ALLOC( C, G ) \
+        TUNE_PLAIN_SSO( C, G, HeapChars ); TUNE_PLAIN_SSO( C, G, RecycledChars )
+    #define TUNE_PLAIN_GROWTH( C ) \
+        TUNE_PLAIN_ALLOC( C, Grow1_5x ); TUNE_PLAIN_ALLOC( C, Grow2x )
+
+    TUNE_PLAIN_GROWTH( CopyInherited );
+    TUNE_PLAIN_GROWTH( CopyExact );
+    TUNE_PLAIN_GROWTH( CopySizeClass );
+    TUNE_CANDIDATE( Plain_FastAlloc, true );
+    TUNE_CANDIDATE( StdString,       true );
+#if defined __GLIBCXX__
+    TUNE_CANDIDATE( StdStringCow,    true );
+#endif
+    TUNE_CANDIDATE( SeqLock,         true );
+    TUNE_CANDIDATE( COW_Unsafe,      false );
+    TUNE_CANDIDATE( COW_AtomicInt,   true );
+    TUNE_CANDIDATE( COW_AtomicInt2,  true );
+    TUNE_CANDIDATE( COW_LazyAtomic,  true );
+    TUNE_CANDIDATE( COW_TaggedUnique,true );
+    TUNE_CANDIDATE( COW_Ordered,     true );
+    TUNE_CANDIDATE( COW_CharPtr,     true );
+    TUNE_CANDIDATE( COW_CritSec,     true );
+    TUNE_CANDIDATE( COW_Mutex,       true );
+    TUNE_CANDIDATE( COW_SpinLock,    true );
+    TUNE_CANDIDATE( COW_TicketLock,  true );
+    TUNE_CANDIDATE( COW_McsLock,     true );
+    TUNE_CANDIDATE( COW_FutexLock,   true );
+    TUNE_CANDIDATE( COW_StdMutex,    true );
+    TUNE_CANDIDATE( Adaptive,        true );
+    TUNE_CANDIDATE( SharedPtr_Make,  true );
+    TUNE_CANDIDATE( SharedPtr_New,   true );
+
+    vector<TuneResult> bySpeed( results ), byMemory( results );
+    sort( bySpeed.begin(), bySpeed.end(), FasterResult );
+    sort( byMemory.begin(), byMemory.end(), SmallerResult );
+
+    cout << "\nFastest:               " << bySpeed[0].name << setprecision(1);
+    if( bySpeed.size() > 1 && bySpeed[1].mopsPerSec > 0 )
+    {
+        cout << ", " << 100.0 * ( bySpeed[0].mopsPerSec / bySpeed[1].mopsPerSec - 1 )
+             << "% ahead of " << bySpeed[1].name;
+    }
+    cout << "\nMost memory-efficient: " << byMemory[0].name;
+    if( byMemory.size() > 1 && byMemory[1].peakBytes > 0 )
+    {
+        cout << ", " << 100.0 * ( 1 - static_cast<double>( byMemory[0].peakBytes ) / byMemory[1].peakBytes )
+             << "% below " << byMemory[1].name;
+    }
+    cout << endl;
+    return 0;
+}
+
+#endif
+
+
+#if defined TEST_INT_OPS_ONLY
+
+#pragma optimize( "g", off )    // the integer loop tests aren't useful with
+                                // optimizations on, because the whole first
+                                // loop will just get optimized away... we
+                                // don't want that, we really want to measure
+                                // how long it takes to increment an int!
+void TestPlainIntOps( long n, long l )
+{
+    // -- NOTE: This test is not meaningful unless compiled with
+    //          optimizations disabled. See the pragma above, or
+    //          change /Ox to /Od in Build.BAT.
+    {
+      long counter = 0;
+      Timer t;
+      while( counter < l )
+      {
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+        ++counter;
+      }
+      cout << "  " << setw(15) << "++plain" << setw(7)
+           << t.Elapsed() << "ms, counter=" << counter << endl;
+    }
+    {
+      long counter = l;
+      Timer t;
+      while( counter > 0 )
+      {
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+        --counter;
+      }
+      cout << "  " << setw(15) << "--plain" << setw(7)
+           << t.Elapsed() << "ms, counter=" << counter << endl;
+    }
+}
+#pragma optimize( "", on )      // reset optimizations to original values
+
+void TestIntOps( long n, long l )
+{
+    for( int j = 0; j < n; ++j )
+    {
+      int nPlain = 0;
+      {
+        TestPlainIntOps( n, l );
+      }
+      cout << endl;
+
+      {
+        volatile long counter = 0;
+        Timer t;
+        while( counter < l )
+        {
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+          ++counter;
+        }
+        cout << "  " << setw(15) << "++volatile" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      {
+        volatile long counter = l;
+        Timer t;
+        while( counter > 0 )
+        {
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+          --counter;
+        }
+        cout << "  " << setw(15) << "--volatile" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      cout << endl;
+
+      {
+        long counter = 0;
+        Timer t;
+        while( counter < l )
+        {
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+          IntAtomicIncrement(counter);
+        }
+        cout << "  " << setw(15) << "++atomic" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      {
+        long counter = l;
+        Timer t;
+        while( counter > 0 )
+        {
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicDecrement(counter);
+          IntAtomicIncrement(counter);
+        }
+        cout << "  " << setw(15) << "--atomic" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      cout << endl;
+
+      {
+        long counter = 0;
+        Timer t;
+        while( counter < l )
+        {
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+          IntAtomicIncrementAss(counter);
+        }
+        cout << "  " << setw(15) << "++atomic_ass" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      {
+        long counter = l, result = 0;
+        Timer t;
+        while( counter > 0 )
+        {
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+          IntAtomicDecrementAss(counter, result);
+        }
+        cout << "  " << setw(15) << "--atomic_ass" << setw(7)
+             << t.Elapsed() << "ms, counter=" << counter << endl;
+      }
+      cout << endl;
+    }
+}
+
+#endif
+
+int main( int argc, char* argv[] )
+{
+    long nRuns = 2, nLoops = 1000 * 1000, nLen = 100;
+    long nThreads = HardwareThreads();
+
+    if( argc > 1)
+    {
+        nRuns = atol( argv[1] );
+    }
+    if( argc > 2)
+    {
+        nLoops = atol( argv[2] );
+    }
+    if( argc > 3)
+    {
+        nLen = atol( argv[3] );
+    }
+    if( argc > 4)
+    {
+        nThreads = atol( argv[4] );
+    }
+
+#if defined TEST_TUNE
+    return Tune( argc > 1 ? argv[1] : "" );
+#endif
+
+    if( argc > 2 && string( argv[1] ) == "-analyze" )
+    {
+        return AnalyzeTrace( argv[2] ) ? 0 : 1;
+    }
+    if( argc > 1 && string( argv[1] ) == "-monitor" )
+    {
+        return Monitor();
+    }
+
+#ifdef TEST_LIVE
+    if( !LiveStats::Start() )
+    {
+        cout << "Couldn't create the live statistics segment.\n";
+    }
+#endif
+
+    cout << "Preparing for clean timing runs... ";
+    Sleep( 1000 );
+    Plain::String throwawayString;
+    Test( throwawayString, 10000, 10 ); // throwaway work
+    Adaptive::Costs();                  // calibrate before anything's timed
+
+#if defined TEST_SHARED_READERS
+
+    int nReaders = max( 1, static_cast<int>(nThreads) - 1 );
+
+    cout << "done.\nRunning " << nReaders << " reader threads x " << nLoops
+         << " reads of one shared string of length " << nLen
+         << ",\nrewritten by one more thread about once a millisecond:\n\n";
+
+    #define RUN_SHARED_TEST( TEST_NAME ) \
+    { \
+        long nWrites = 0; \
+        LIVE_RUN( "shared readers", #TEST_NAME, nReaders + 1, &TEST_NAME::String::stats ); \
+        cout << "  " << setw(15) << #TEST_NAME; \
+        cout << setw(7) << TestSharedReaders<TEST_NAME::String>( nLoops, nLen, nReaders, nWrites ); \
+        cout << "ms  rewrites:" << setw(6) << nWrites; \
+        cout << endl; \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_SHARED_TEST( SeqLock );
+        RUN_SHARED_TEST( COW_AtomicInt2 );
+        RUN_SHARED_TEST( COW_CharPtr );
+        RUN_SHARED_TEST( SharedPtr_Make );
+        RUN_SHARED_TEST( SharedPtr_New );
+        RUN_SHARED_TEST( COW_CritSec );
+        RUN_SHARED_TEST( COW_SpinLock );
+        RUN_SHARED_TEST( COW_McsLock );
+
+        cout << endl;
+    }
+
+#elif defined TEST_LOCKS
+
+    cout << "done.\nRunning " << nLoops << " lock/unlock pairs per thread, 1 to "
+         << nThreads << " threads on one lock:\n\n";
+
+    #define RUN_LOCK_TEST( LOCK_NAME ) \
+    { \
+        for( int t = 1; ; t = min( t*2, static_cast<int>(nThreads) ) ) \
+        { \
+            int ms = TestLock<LOCK_NAME>( nLoops, t ); \
+            cout << "  " << setw(15) << #LOCK_NAME << "  threads:" << setw(3) << t; \
+            cout << setw(7) << ms << "ms  ns/pair:" << setw(8) << fixed << setprecision(1) \
+                 << ms * 1e6 / nLoops \
+                 << "  Mpairs/s:" << setw(7) << setprecision(2) \
+                 << ( ms ? t * (nLoops / 1000.0) / ms : 0.0 ) \
+                 << endl; \
+            if( t >= nThreads ) break; \
+        } \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_LOCK_TEST( CriticalSection );
+        RUN_LOCK_TEST( Mutex );
+        RUN_LOCK_TEST( SpinLock );
+        RUN_LOCK_TEST( TicketLock );
+        RUN_LOCK_TEST( McsLock );
+        RUN_LOCK_TEST( FutexLock );
+        RUN_LOCK_TEST( StdMutex );
+
+        cout << endl;
+    }
+
+#elif defined TEST_OVERSUBSCRIBED
+
+    cout << "done.\nRunning " << nTimedRunMs << "ms per test with strings of length "
+         << nLen << ",\non 1x to 8x as many threads as the " << nThreads
+         << " cores (latency is per 25 cycles):\n\n";
+
+    #define RUN_OVERSUBSCRIBED_TEST( TEST_NAME ) \
+    { \
+        const char* labels[] = { "x1", "x2", "x4", "x8" }; \
+        for( int k = 0; k < 4; ++k ) \
+        { \
+            TimedRun r; \
+            LIVE_RUN( "oversubscribed", #TEST_NAME, (1 << k) * nThreads, &TEST_NAME::String::stats ); \
+            TestTimed<TEST_NAME::String>( nLen, (1 << k) * nThreads, nTimedRunMs, r ); \
+            PrintTimedRun( #TEST_NAME, labels[k], r ); \
+        } \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_OVERSUBSCRIBED_TEST( COW_CritSec );
+        RUN_OVERSUBSCRIBED_TEST( COW_Mutex );
+        RUN_OVERSUBSCRIBED_TEST( COW_SpinLock );
+        RUN_OVERSUBSCRIBED_TEST( COW_TicketLock );
+        RUN_OVERSUBSCRIBED_TEST( COW_McsLock );
+        RUN_OVERSUBSCRIBED_TEST( COW_FutexLock );
+        RUN_OVERSUBSCRIBED_TEST( COW_StdMutex );
+
+        RUN_OVERSUBSCRIBED_TEST( COW_AtomicInt );
+        RUN_OVERSUBSCRIBED_TEST( COW_AtomicInt2 );
+        RUN_OVERSUBSCRIBED_TEST( SharedPtr_Make );
+        RUN_OVERSUBSCRIBED_TEST( COW_LazyAtomic );
+        RUN_OVERSUBSCRIBED_TEST( COW_TaggedUnique );
+        RUN_OVERSUBSCRIBED_TEST( SeqLock );
+        RUN_OVERSUBSCRIBED_TEST( Plain );
+        RUN_OVERSUBSCRIBED_TEST( StdString );
+#if defined __GLIBCXX__
+        RUN_OVERSUBSCRIBED_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_SCALING
+
+    cout << "done.\nRunning " << nTimedRunMs << "ms per test with strings of length "
+         << nLen << ",\non 1 to " << nThreads << " pinned threads (also written to scaling.csv):\n\n";
+
+    ofstream csv( "scaling.csv" );
+    csv << "run,implementation,threads,ms,ops,ops_per_sec,speedup,efficiency" << endl;
+    csv << fixed << setprecision(3);
+
+    #define RUN_SCALING_TEST( TEST_NAME ) \
+        TestScaling<TEST_NAME::String>( #TEST_NAME, nLen, nThreads, i, csv )
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_SCALING_TEST( Plain_FastAlloc );
+        RUN_SCALING_TEST( Plain );
+        RUN_SCALING_TEST( COW_AtomicInt );
+        RUN_SCALING_TEST( COW_AtomicInt2 );
+        RUN_SCALING_TEST( COW_Ordered );
+        RUN_SCALING_TEST( SharedPtr_Make );
+        RUN_SCALING_TEST( SharedPtr_New );
+        RUN_SCALING_TEST( COW_LazyAtomic );
+        RUN_SCALING_TEST( COW_TaggedUnique );
+        RUN_SCALING_TEST( COW_CritSec );
+        RUN_SCALING_TEST( COW_Mutex );
+        RUN_SCALING_TEST( COW_SpinLock );
+        RUN_SCALING_TEST( COW_TicketLock );
+        RUN_SCALING_TEST( COW_McsLock );
+        RUN_SCALING_TEST( COW_FutexLock );
+        RUN_SCALING_TEST( COW_StdMutex );
+        RUN_SCALING_TEST( SeqLock );
+
+        RUN_SCALING_TEST( StdString );
+#if defined __GLIBCXX__
+        RUN_SCALING_TEST( StdStringCow );
+#endif
+#ifdef _MSC_VER
+        RUN_SCALING_TEST( AtlString );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_INSTR_COST
+
+    cout << "done.\nRunning " << nLoops << " iterations with strings of length " << nLen
+         << ",\nuninstrumented, then with counters, then with event tracing:\n\n";
+
+    #define RUN_INSTR_COST_TEST( TEST_NAME ) \
+    { \
+        TEST_NAME::String        plainString; \
+        TEST_NAME::CountedString countedString; \
+        TEST_NAME::TracedString  tracedString; \
+        int ms   = Test( plainString, nLoops, nLen ); \
+        int msC  = Test( countedString, nLoops, nLen ); \
+        int msT  = Test( tracedString, nLoops, nLen ); \
+        PrintInstrCost( #TEST_NAME, ms, msC, msT ); \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_INSTR_COST_TEST( Plain_FastAlloc );
+        RUN_INSTR_COST_TEST( Plain );
+        RUN_INSTR_COST_TEST( COW_Unsafe );
+        RUN_INSTR_COST_TEST( COW_AtomicInt );
+        RUN_INSTR_COST_TEST( COW_AtomicInt2 );
+        RUN_INSTR_COST_TEST( COW_CritSec );
+        RUN_INSTR_COST_TEST( COW_SpinLock );
+        RUN_INSTR_COST_TEST( SeqLock );
+
+        cout << endl;
+    }
+
+#elif defined TEST_TRACE
+
+    cout << "done.\nTracing " << nLoops << " iterations with strings of length " << nLen
+         << " (the last " << TraceLog::nTraceEvents << " events per thread):\n\n";
+
+    #define RUN_TRACE_TEST( TEST_NAME ) \
+    { \
+        string file = string( "trace-" ) + #TEST_NAME + ".bin"; \
+        TraceLog::Reset(); \
+        TestTraced<TEST_NAME::TracedString>( #TEST_NAME, nLoops, nLen ); \
+        cout << "  " << setw(15) << #TEST_NAME << setw(9) << TraceLog::Dump( file.c_str() ) \
+             << " events written to " << file << "\n"; \
+        AnalyzeTrace( file.c_str() ); \
+        cout << endl; \
+    }
+
+    RUN_TRACE_TEST( Plain );
+    RUN_TRACE_TEST( COW_Unsafe );
+    RUN_TRACE_TEST( COW_AtomicInt2 );
+    RUN_TRACE_TEST( COW_CritSec );
+    RUN_TRACE_TEST( SeqLock );
+
+#elif defined TEST_LAZY_ATOMIC
+
+    cout << "done.\nRunning " << nLoops << " iterations with strings of length " << nLen
+         << " on one thread, then on " << nThreads << " threads for " << nTimedRunMs << "ms:\n";
+
+    #define RUN_LAZY_TEST( TEST_NAME ) \
+    { \
+        TEST_NAME::String testString; \
+        cout << "  " << setw(15) << #TEST_NAME; \
+        cout << setw(7) << Test( testString, nLoops, nLen ); \
+        cout << "ms" << endl; \
+    }
+
+    for( int k = 0; k < 2; ++k )
+    {
+        if( k == 1 && !ThreadsStarted() )
+        {
+            IdleWorker idle;
+            Thread<IdleWorker> t( idle );
+        }
+        cout << ( ThreadsStarted() ? "\nAfter a second thread has started:\n\n"
+                                   : "\nBefore any other thread has started:\n\n" );
+        for( int i = 1; i <= nRuns; ++i )
+        {
+            RUN_LAZY_TEST( COW_Unsafe );
+            RUN_LAZY_TEST( COW_AtomicInt2 );
+            RUN_LAZY_TEST( COW_LazyAtomic );
+            cout << endl;
+        }
+    }
+
+    cout << "On " << nThreads << " threads:\n\n";
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        TimedRun r;
+        TestTimed<COW_AtomicInt2::String>( nLen, nThreads, nTimedRunMs, r );
+        PrintTimedRun( "COW_AtomicInt2", "", r );
+        TestTimed<COW_LazyAtomic::String>( nLen, nThreads, nTimedRunMs, r );
+        PrintTimedRun( "COW_LazyAtomic", "", r );
+        cout << endl;
+    }
+
+#elif defined TEST_MEMORY_ORDER
+
+    cout << "done.\nRunning " << nLoops << " iterations with strings of length " << nLen
+         << " on one thread, then " << nTimedRunMs << "ms on " << nThreads << " threads,"
+         << "\nfor each order of increment, decrement and uniqueness check:\n\n";
+
+    #define RUN_ORDER_TEST( INC, DEC, CHK ) \
+    { \
+        typedef COW_Ordered::BasicString<NoInstr, COW_Ordered::Orders< \
+            memory_order_##INC, memory_order_##DEC, memory_order_##CHK> > S; \
+        S testString; \
+        TimedRun r; \
+        cout << "  " << setw(8) << #INC << setw(8) << #DEC << setw(8) << #CHK; \
+        cout << setw(7) << Test( testString, nLoops, nLen ) << "ms"; \
+        TestTimed<S>( nLen, nThreads, nTimedRunMs, r ); \
+        cout << "  Mops/s:" << setw(7) << fixed << setprecision(2) \
+             << ( r.ms ? r.ops / ( r.ms * 1000.0 ) : 0.0 ) << endl; \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        cout << "  " << setw(8) << "inc" << setw(8) << "dec" << setw(8) << "chk" << endl;
+        RUN_ORDER_TEST( seq_cst, seq_cst, seq_cst );
+        RUN_ORDER_TEST( seq_cst, seq_cst, acquire );
+        RUN_ORDER_TEST( seq_cst, acq_rel, seq_cst );
+        RUN_ORDER_TEST( seq_cst, acq_rel, acquire );
+        RUN_ORDER_TEST( seq_cst, release, seq_cst );
+        RUN_ORDER_TEST( seq_cst, release, acquire );
+        RUN_ORDER_TEST( relaxed, seq_cst, seq_cst );
+        RUN_ORDER_TEST( relaxed, seq_cst, acquire );
+        RUN_ORDER_TEST( relaxed, acq_rel, seq_cst );
+        RUN_ORDER_TEST( relaxed, acq_rel, acquire );
+        RUN_ORDER_TEST( relaxed, release, seq_cst );
+        RUN_ORDER_TEST( relaxed, release, acquire );
+
+        TimedRun r;
+        COW_AtomicInt2::String testString;
+        cout << "  " << setw(24) << "COW_AtomicInt2";
+        cout << setw(7) << Test( testString, nLoops, nLen ) << "ms";
+        TestTimed<COW_AtomicInt2::String>( nLen, nThreads, nTimedRunMs, r );
+        cout << "  Mops/s:" << setw(7) << fixed << setprecision(2)
+             << ( r.ms ? r.ops / ( r.ms * 1000.0 ) : 0.0 ) << endl << endl;
+    }
+
+#elif defined TEST_READ_HEAVY
+
+    cout << "done.\nRunning " << nLoops << " const copies of a string of length " << nLen
+         << ", each read through,\nthen " << static_cast<long long>( nLoops ) * nLen << " reads of one character:\n\n";
+
+    #define RUN_READ_TEST( TEST_NAME ) \
+    { \
+        cout << "  " << setw(15) << #TEST_NAME; \
+        cout << "  scan:"  << setw(6) << TestReadHeavy<TEST_NAME::String>( nLoops, nLen, true ) << "ms"; \
+        cout << "  point:" << setw(6) << TestReadHeavy<TEST_NAME::String>( static_cast<long long>( nLoops ) * nLen, nLen, false ) << "ms"; \
+        cout << endl; \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_READ_TEST( COW_AtomicInt2 );
+        RUN_READ_TEST( COW_CharPtr );
+        RUN_READ_TEST( COW_TaggedUnique );
+        RUN_READ_TEST( Adaptive );
+#if defined __GLIBCXX__
+        RUN_READ_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_PROFILE
+
+    cout << "done.\nRunning a " << nLoops << "-iteration workload with strings of length " << nLen
+         << ",\nthen again sampling 1 in " << StringProfiler::Rate() << " string events:\n\n";
+
+    #define RUN_PROFILE_TEST( TEST_NAME ) \
+        TestProfiled<TEST_NAME::String, TEST_NAME::SampledString>( #TEST_NAME, nLoops, nLen )
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_PROFILE_TEST( Plain );
+        RUN_PROFILE_TEST( COW_Unsafe );
+        RUN_PROFILE_TEST( COW_AtomicInt );
+        RUN_PROFILE_TEST( COW_AtomicInt2 );
+        RUN_PROFILE_TEST( COW_CritSec );
+        RUN_PROFILE_TEST( SeqLock );
+        RUN_PROFILE_TEST( StdString );
+
+        cout << endl;
+    }
+
+#elif defined TEST_USEFULNESS
+
+    cout << "done.\nFollowing every copy in a " << nLoops << "-iteration workload with strings of length "
+         << nLen << ":\n\n";
+
+    #define RUN_USEFULNESS_TEST( TEST_NAME ) \
+    { \
+        CopyUsefulness::Reset(); \
+        int ms = ProfiledWorkload< Tracked<TEST_NAME::String> >( nLoops, nLen ); \
+        cout << "  " << setw(15) << #TEST_NAME << setw(7) << ms << "ms (tracked)\n"; \
+        PrintUsefulness(); \
+        cout << endl; \
+    }
+
+    RUN_USEFULNESS_TEST( Plain );
+    RUN_USEFULNESS_TEST( StdString );
+
+#elif defined TEST_MUTATION_SWEEP
+
+    cout << "done.\nRunning " << nLoops << " copies of a string of length " << nLen
+         << ", 0% to 100% of them then mutated.\nAdaptive measures that it should go eager at "
+         << Adaptive::EagerPercent( nLen ) << "% mutated, and its mode is the one it settled on:\n\n"
+         << "  mutated    Plain  COW_AtomicInt2  Adaptive  vs best   mode\n";
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        for( int pct = 0; pct <= 100; pct += nSweepStep )
+        {
+            int msPlain = TestMutationRatio<Plain::String>( nLoops, nLen, pct );
+            int msCow   = TestMutationRatio<COW_AtomicInt2::String>( nLoops, nLen, pct );
+            int msAdapt = TestMutationRatio<Adaptive::String>( nLoops, nLen, pct );
+            int msBest  = min( msPlain, msCow );
+            cout << "  " << setw(6) << pct << "%" << setw(7) << msPlain << "ms"
+                 << setw(14) << msCow << "ms" << setw(8) << msAdapt << "ms"
+                 << setw(8) << showpos << fixed << setprecision(1)
+                 << ( msAdapt - msBest ) * 100.0 / max( msBest, 1 ) << noshowpos << "%   "
+                 << ( Adaptive::String::DefaultSite().eager ? "eager" : "shared" ) << endl;
+        }
+        cout << "  (Adaptive switched modes " << Adaptive::String::DefaultSite().switches
+             << " times so far)\n" << endl;
+    }
+
+#elif defined TEST_COPY_CAPACITY
+
+    long nAppends = max( nLen / 4, 1L );
+
+    cout << "done.\nRunning " << nLoops << " copies of a Plain string of length " << nLen
+         << ", then " << nLoops << " more with " << nAppends << " Appends each:\n\n";
+
+    #define RUN_CAPACITY_TEST( POLICY ) \
+    { \
+        CopyCapacityRun r; \
+        TestCopyCapacity<Plain::POLICY>( nLoops, nLen, nAppends, r ); \
+        cout << "  " << setw(15) << #POLICY << "  bytes/copy:" << setw(6) << r.bytes \
+             << "  copy:" << setw(5) << r.msCopy << "ms" \
+             << "  copy+appends:" << setw(5) << r.msAppend << "ms" \
+             << "  grows/copy:" << setw(5) << fixed << setprecision(2) << r.growsPerCopy << endl; \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_CAPACITY_TEST( CopyInherited );
+        RUN_CAPACITY_TEST( CopyExact );
+        RUN_CAPACITY_TEST( CopySizeClass );
+
+        cout << "  build " << nLoops << " strings by Append: "
+             << setw(5) << TestBuild( nLoops, nLen, false ) << "ms, with a capacity hint: "
+             << setw(5) << TestBuild( nLoops, nLen, true ) << "ms\n" << endl;
+    }
+
+#elif defined TEST_FUNCTION_BOUNDARY
+
+    cout << "done.\nRunning " << nLoops << " calls per scenario with strings of length " << nLen
+         << "\n(timed without instrumentation, counted per call in a second, untimed run):\n\n";
+
+    #define RUN_BOUNDARY_TEST( TEST_NAME ) \
+    { \
+        for( int k = 0; k < nBoundaryScenarios; ++k ) \
+        { \
+            LIVE_RUN( boundaryNames[k], #TEST_NAME, 1, &TEST_NAME::String::stats ); \
+            int ms = TestBoundary<TEST_NAME::String>( nLoops, nLen, k ); \
+            TestBoundary<TEST_NAME::CountedString>( nLoops, nLen, k ); \
+            Counts c = TEST_NAME::CountedString::stats.Total(); \
+            double per = 1.0 / max( nLoops, 1L ); \
+            cout << "  " << setw(15) << ( k ? "" : #TEST_NAME ) << setw(11) << boundaryNames[k] \
+                 << setw(6) << ms << "ms" << fixed << setprecision(2) \
+                 << "  copies:" << setw(5) << c.copies * per \
+                 << "  moves:"  << setw(5) << c.moves * per \
+                 << "  deep:"   << setw(5) << c.deepCopies * per \
+                 << "  allocs:" << setw(5) << c.allocs * per << endl; \
+        } \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_BOUNDARY_TEST( Plain );
+        RUN_BOUNDARY_TEST( StdString );
+        RUN_BOUNDARY_TEST( COW_Unsafe );
+        RUN_BOUNDARY_TEST( COW_AtomicInt2 );
+        RUN_BOUNDARY_TEST( SharedPtr_Make );
+#if defined __GLIBCXX__
+        RUN_BOUNDARY_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_HANDOFF
+
+    cout << "done.\nHanding off " << nLoops << " strings of length " << nLen << " per producer, "
+         << max( nThreads / 2, 1L ) << " producer(s) and " << max( nThreads - max( nThreads / 2, 1L ), 1L )
+         << " consumer(s)\n(timed without instrumentation, counted per string in a second, untimed run):\n\n";
+
+    #define RUN_HANDOFF_TEST( TEST_NAME ) \
+    { \
+        for( int k = 0; k < nHandoffVariants; ++k ) \
+        { \
+            LIVE_RUN( handoffNames[k], #TEST_NAME, static_cast<int>( nThreads ), &TEST_NAME::String::stats ); \
+            int ms = TestHandoff<TEST_NAME::String>( nLoops, nLen, k, static_cast<int>( nThreads ) ); \
+            TestHandoff<TEST_NAME::CountedString>( nLoops, nLen, k, static_cast<int>( nThreads ) ); \
+            Counts c = TEST_NAME::CountedString::stats.Total(); \
+            double strings = static_cast<double>( nLoops ) * max( nThreads / 2, 1L ); \
+            cout << "  " << setw(15) << ( k ? "" : #TEST_NAME ) << setw(6) << handoffNames[k] \
+                 << setw(6) << ms << "ms" << setw(8) << static_cast<long>( ms * 1e6 / strings ) << "ns/string" \
+                 << fixed << setprecision(2) \
+                 << "  copies:" << setw(5) << c.copies / strings \
+                 << "  moves:"  << setw(5) << c.moves / strings \
+                 << "  deep:"   << setw(5) << c.deepCopies / strings \
+                 << "  allocs:" << setw(5) << c.allocs / strings << endl; \
+        } \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_HANDOFF_TEST( Plain );
+        RUN_HANDOFF_TEST( StdString );
+        RUN_HANDOFF_TEST( COW_AtomicInt2 );
+        RUN_HANDOFF_TEST( COW_CritSec );
+        RUN_HANDOFF_TEST( COW_CharPtr );
+        RUN_HANDOFF_TEST( SharedPtr_Make );
+#if defined __GLIBCXX__
+        RUN_HANDOFF_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_COROUTINE_PIPELINE && !defined __cpp_impl_coroutine
+
+    cout << "done.\nTEST_COROUTINE_PIPELINE needs a compiler with C++20 coroutines "
+            "(/std:c++latest, or -std=c++20).\n";
+
+#elif defined TEST_COROUTINE_PIPELINE
+
+    cout << "done.\nRunning " << nLoops << " strings of length " << nLen << " through parse, transform, format and emit"
+         << "\n(timed without instrumentation, counted per string in a second, untimed run):\n\n";
+
+    #define RUN_PIPELINE_TEST( TEST_NAME ) \
+    { \
+        for( int k = 0; k < 2; ++k ) \
+        { \
+            LIVE_RUN( k ? "pipeline move" : "pipeline copy", #TEST_NAME, 1, &TEST_NAME::String::stats ); \
+            int ms = TestPipeline<TEST_NAME::String>( nLoops, nLen, k != 0 ); \
+            TestPipeline<TEST_NAME::CountedString>( nLoops, nLen, k != 0 ); \
+            Counts c = TEST_NAME::CountedString::stats.Total(); \
+            double per = 1.0 / max( nLoops, 1L ); \
+            cout << "  " << setw(17) << ( k ? "" : #TEST_NAME ) << setw(5) << ( k ? "move" : "copy" ) \
+                 << setw(6) << ms << "ms" << setw(8) << static_cast<long>( ms * 1e6 * per ) << "ns/string" \
+                 << fixed << setprecision(2) \
+                 << "  copies:" << setw(5) << c.copies * per \
+                 << "  moves:"  << setw(5) << c.moves * per \
+                 << "  deep:"   << setw(5) << c.deepCopies * per \
+                 << "  allocs:" << setw(5) << c.allocs * per << endl; \
+        } \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_PIPELINE_TEST( Plain_FastAlloc );
+        RUN_PIPELINE_TEST( Plain );
+        RUN_PIPELINE_TEST( COW_Unsafe );
+        RUN_PIPELINE_TEST( COW_AtomicInt );
+        RUN_PIPELINE_TEST( COW_AtomicInt2 );
+        RUN_PIPELINE_TEST( COW_LazyAtomic );
+        RUN_PIPELINE_TEST( COW_TaggedUnique );
+        RUN_PIPELINE_TEST( COW_Ordered );
+        RUN_PIPELINE_TEST( COW_CharPtr );
+        RUN_PIPELINE_TEST( COW_CritSec );
+        RUN_PIPELINE_TEST( COW_Mutex );
+        RUN_PIPELINE_TEST( COW_SpinLock );
+        RUN_PIPELINE_TEST( COW_TicketLock );
+        RUN_PIPELINE_TEST( COW_McsLock );
+        RUN_PIPELINE_TEST( COW_FutexLock );
+        RUN_PIPELINE_TEST( COW_StdMutex );
+        RUN_PIPELINE_TEST( SeqLock );
+        RUN_PIPELINE_TEST( Adaptive );
+        RUN_PIPELINE_TEST( SharedPtr_Make );
+        RUN_PIPELINE_TEST( SharedPtr_New );
+        RUN_PIPELINE_TEST( StdString );
+#if defined __GLIBCXX__
+        RUN_PIPELINE_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif defined TEST_BATCH
+
+    cout << "done.\nProcessing " << nLoops << " records of length " << nLen << " in grains of "
+         << nBatchGrain << ", on 1 thread and on " << nThreads << ":\n\n";
+
+    #define RUN_BATCH_TEST( TEST_NAME ) \
+    { \
+        BatchRun one, all; \
+        LIVE_RUN( "batch", #TEST_NAME, 1, &TEST_NAME::String::stats ); \
+        TestBatch<TEST_NAME::String>( nLoops, nLen, 1, one ); \
+        LIVE_RUN( "batch", #TEST_NAME, static_cast<int>( nThreads ), &TEST_NAME::String::stats ); \
+        TestBatch<TEST_NAME::String>( nLoops, nLen, static_cast<int>( nThreads ), all ); \
+        cout << "  " << setw(17) << #TEST_NAME \
+             << setw(6) << one.ms << "ms" << setw(7) << nLoops / max( one.ms, 1 ) << "K records/s" \
+             << setw(8) << all.ms << "ms" << setw(7) << nLoops / max( all.ms, 1 ) << "K records/s" \
+             << fixed << setprecision(2) << setw(7) << static_cast<double>( one.ms ) / max( all.ms, 1 ) << "x" \
+             << setw(7) << all.steals << " steals" << endl; \
+    }
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_BATCH_TEST( Plain_FastAlloc );
+        RUN_BATCH_TEST( Plain );
+        RUN_BATCH_TEST( COW_Unsafe );
+        RUN_BATCH_TEST( COW_AtomicInt );
+        RUN_BATCH_TEST( COW_AtomicInt2 );
+        RUN_BATCH_TEST( COW_LazyAtomic );
+        RUN_BATCH_TEST( COW_TaggedUnique );
+        RUN_BATCH_TEST( COW_Ordered );
+        RUN_BATCH_TEST( COW_CharPtr );
+        RUN_BATCH_TEST( COW_CritSec );
+        RUN_BATCH_TEST( COW_Mutex );
+        RUN_BATCH_TEST( COW_SpinLock );
+        RUN_BATCH_TEST( COW_TicketLock );
+        RUN_BATCH_TEST( COW_McsLock );
+        RUN_BATCH_TEST( COW_FutexLock );
+        RUN_BATCH_TEST( COW_StdMutex );
+        RUN_BATCH_TEST( SeqLock );
+        RUN_BATCH_TEST( Adaptive );
+        RUN_BATCH_TEST( SharedPtr_Make );
+        RUN_BATCH_TEST( SharedPtr_New );
+        RUN_BATCH_TEST( StdString );
+#if defined __GLIBCXX__
+        RUN_BATCH_TEST( StdStringCow );
+#endif
+
+        cout << endl;
+    }
+
+#elif !defined TEST_INT_OPS_ONLY
+
+    cout << "done.\nRunning " << nLoops << " iterations with strings of length " << nLen
+         << "\n(timed without instrumentation, counted in a second, untimed run):\n\n";
+
+#ifdef TEST_RECYCLE
+    #define RECYCLE_RESET()     RecycleCache::Reset()
+    #define RECYCLE_PRINT()     PrintRecycled( RecycleCache::Total() )
+#else
+    #define RECYCLE_RESET()
+    #define RECYCLE_PRINT()
+#endif
+
+    // Create a local variable testString instead of using VC++'s non-standard extension
+    // (conversion from X to X&)
+    #define RUN_TEST( TEST_NAME ) \
+    { \
+        TEST_NAME::String testString; \
+        LIVE_RUN( "single-threaded", #TEST_NAME, 1, &TEST_NAME::String::stats ); \
+        cout << "  " << setw(15) << #TEST_NAME; \
+        cout << setw(7) << Test(testString, nLoops, nLen ); \
+        cout << "ms"; \
+        TEST_NAME::CountedString countedString; \
+        LIVE_RUN( "counted", #TEST_NAME, 1, &TEST_NAME::CountedString::stats ); \
+        RECYCLE_RESET(); \
+        Test( countedString, nLoops, nLen ); \
+        PrintCounts( TEST_NAME::CountedString::stats.Total() ); \
+        RECYCLE_PRINT(); \
+        cout << endl; \
+    }
+
+
+    for( int i = 1; i <= nRuns; ++i )
+    {
+        RUN_TEST( Plain_FastAlloc );
+        RUN_TEST( Plain );
+        RUN_TEST( COW_Unsafe );
+        RUN_TEST( COW_AtomicInt );
+        RUN_TEST( COW_AtomicInt2 );
+        RUN_TEST( COW_LazyAtomic );
+        RUN_TEST( COW_TaggedUnique );
+        RUN_TEST( COW_Ordered );
+        RUN_TEST( COW_CharPtr );
+        RUN_TEST( COW_CritSec );
+        RUN_TEST( COW_Mutex );
+        RUN_TEST( COW_SpinLock );
+        RUN_TEST( COW_TicketLock );
+        RUN_TEST( COW_McsLock );
+        RUN_TEST( COW_FutexLock );
+        RUN_TEST( COW_StdMutex );
+        RUN_TEST( SeqLock );
+        RUN_TEST( Adaptive );
+        RUN_TEST( SharedPtr_Make );
+        RUN_TEST( SharedPtr_New );
+        
+        RUN_TEST( StdString );
+#if defined __GLIBCXX__
+        RUN_TEST( StdStringCow );
+#endif
+#ifdef _MSC_VER
+        RUN_TEST( AtlString );
+#endif
+
+        cout << endl;
+    }
+
+#else
+
+    cout << "done.\nRunning " << nLoops << " iterations for integer operations:\n\n";
+    TestIntOps( nRuns, nLoops );
+
+#endif
+
+#ifdef TEST_LIVE
+    LiveStats::Stop();
+#endif
+
+    return 0;
+}
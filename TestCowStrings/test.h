@@ -1,320 +1,2778 @@
-////////////////////////////////////////////////////////////////////////////////
-//
-// String Performance Tests Based on Herb Sutter's GotW #45.
-//
-// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
-//
-////////////////////////////////////////////////////////////////////////////////
-
-
-//==============================================================================
-//
-//  Guru of the Week #45: Sample code, and performance test harness.
-//
-//  Version 2.0: Changes include the following:
-//
-//      - changed reference count from unsigned to long, and "unshareable"
-//          state is now flagged by a negative number
-//
-//      - changed IntAtomicGet to IntAtomicCompare
-//
-//      - inlined everything
-//
-//      - changed AboutToModify to EnsureUnique and EnsureUnshareable, in order
-//          to avoid passing the "bMarkUnshareable" bool as a runtime flag when
-//          this is after all known at compile time
-//
-//      - created fixed-size allocator (i.e., "fast allocator") for StringBuf
-//          to eliminate any issues related to double allocation penalties
-//
-//      - added non-COW test cases, including one that uses a fast allocator
-//          (the original version compared only various thread-safe and -unsafe
-//          flavours of COW, and didn't compare plain non-COW)
-//
-//      - added alternatively-optimized COW test cases, include COW_AtomicInt2
-//          that avoids a secondary allocation by using a single buffer for the
-//          len/used/refs values and the string data
-//
-//      - added native x86 assembler versions of the AtomicInt functions to
-//          show that the Win32 operations were equally efficient (no, there's
-//          no function-call overhead)
-//
-//      - added ability to test copying and Append, in addition to operator[],
-//          which also meant adding a function to shrink a string
-//
-//      - changed from calling copy to calling memcpy... on my compiler,
-//          memcpy was about three times faster (indicating that perhaps this
-//          implementation ought to specialize copy for builtin types), and
-//          the majority of COW's performance advantage came from avoiding the
-//          inefficient copy, not from avoiding the allocation
-//
-//      - a lot of miscellaneous things I probably forgot to document
-//
-//  Copyright (c) 1998 by H.P.Sutter. All rights reserved. You may download and
-//  compile and play with this code to your heart's content, but you may not
-//  redistribute it; instead, please just include a link to this code at the
-//  official GotW site.
-//
-//==============================================================================
-
-
-//------------------------------------------------------------------------------
-//
-//  Here are good (but mostly platform-specific) sample implementations for
-//  CriticalSection, Mutex, IntAtomicXxx (Win32 and inline assembler), Timer,
-//  and FastArena.
-//
-//------------------------------------------------------------------------------
-
-#include <windows.h>
-
-
-//------------------------------------------------------------------------------
-
-//  Helper class to ensure locks are acquired and released in pairs, even in
-//  the presence of exceptions.
-//
-template<class T>
-class Lock
-{
-public:
-  Lock( T& t )
-    : t_(t),
-      bLocked_(true)
-  {
-    t_.Lock();
-  }
-
- ~Lock() {
-    Unlock();
-  }
-
-  void Unlock() {
-    if( bLocked_ ) {
-      t_.Unlock();
-      bLocked_ = false;
-    }
-  }
-private:
-  T& t_;
-  bool bLocked_;
-};
-
-class CriticalSection
-{
-public:
-  CriticalSection() { InitializeCriticalSection( &cs_ ); }
-private:
-  friend Lock<CriticalSection>;
-  void Lock()       { EnterCriticalSection( &cs_ ); }
-  void Unlock()     { LeaveCriticalSection( &cs_ ); }
-  CRITICAL_SECTION cs_;
-};
-
-class Mutex
-{
-public:
-  Mutex()
-   : m_(0)
-  {
-    SECURITY_ATTRIBUTES sec;
-    sec.nLength = sizeof( sec );
-    sec.lpSecurityDescriptor = 0;
-    sec.bInheritHandle = false;
-    m_ = CreateMutex( &sec, false, L"" );
-  }
-
-  ~Mutex()
-  {
-    if( m_ )
-    {
-      CloseHandle(m_);
-      m_ = 0;
-    }
-  }
-
-private:
-  friend Lock<Mutex>;
-  void Lock()     { WaitForSingleObject( m_, INFINITE ); }
-  void Unlock()   { ReleaseMutex( m_ ); }
-  HANDLE m_;
-};
-
-
-//------------------------------------------------------------------------------
-
-//  Odd... for some reason InterlockedExchangeAdd is not available in
-//  Windows 95, so this code won't run on that OS. It's available under
-//  Windows 98 and NT, though. Oh well.
-//
-inline long IntAtomicCompare( long& i, long v )
-{
-  long ii = InterlockedExchangeAdd( &i, 0 );
-  return ( (ii) < (v) ? -1 : ( (ii) == (v) ? 0 : 1 ) );
-}
-inline long IntAtomicIncrement( long& i ) { return InterlockedIncrement( &i ); }
-inline long IntAtomicDecrement( long& i ) { return InterlockedDecrement( &i ); }
-
-
-
-//------------------------------------------------------------------------------
-
-class Timer
-{
-public:
-  Timer() : _start( PerfCounter() ) { }
-  
-  int Elapsed() // milliseconds 
-  { 
-      const long long finish = PerfCounter();
-
-      double elapsedMilliseconds = ((finish - _start) * 1000.0) / PerfFrequency();
-
-      return static_cast<int>(elapsedMilliseconds);
-  }
-
-private:
-  const long long _start;
-
-  static long long PerfCounter()
-  {
-      LARGE_INTEGER li;
-      QueryPerformanceCounter(&li);
-      return li.QuadPart;
-  }
-
-  static long long PerfFrequency()
-  {
-      LARGE_INTEGER li;
-      QueryPerformanceFrequency(&li);
-      return li.QuadPart;
-  }
-
-};
-
-
-//------------------------------------------------------------------------------
-//
-//  A (very) simple fixed-length allocator.
-
-//#define FA_REPORT      1
-//#define FA_DEBUG       1
-#define FA_THREAD_SAFE 1
-
-class FastArena
-{
-public:
-  FastArena( const char* name = "", size_t n = 3000 )
-    : n_( n ? 4*((n-1)/4+1) : 4 ) // make the chunk size a multiple of 4
-    , buf_( new char[(n_+sizeof(long))*size] )
-#ifdef FA_REPORT
-    , current_(0)
-    , highest_(0)
-    , totalops_(0)
-    , name_( name )
-#endif
-  {
-    UNREFERENCED_PARAMETER(name);
-    
-    for( char* p = buf_; p < buf_ + (n_+sizeof(long))*size; p += (n_+sizeof(long)) )
-    {
-        *((long*)p) = 0;
-    }
-  }
-
-  ~FastArena()
-  {
-#ifdef FA_REPORT
-    cout << "FastArena " << setw(Ass0) << name_
-         << ": current_=" << current_
-         << ", highest_=" << highest_
-         << ", totalops_=" << totalops_ << "\n";
-#endif
-    delete[] buf_;
-    buf_ = 0;
-  }
-
-  void* Allocate( size_t n )
-  {
-    if( n > n_ )
-    {
-#ifdef FA_DEBUG
-      cout << "Bad Allocate: size " << n << ", expected at most " << n_ << "\n" << flush;
-#endif
-      throw bad_alloc();    // ensure we're not getting surprises
-    }
-
-    char* p = buf_;
-    while( p < (buf_ + (n_+sizeof(long))*size) && *((long*)p) != 0 )
-    {
-      p += (n_+sizeof(long));
-    }
-
-    if( p >= (buf_ + (n_+sizeof(long))*size) )
-    {
-#ifdef FA_DEBUG
-      cout << "Bad Allocate: exhausted, current_=" << current_ << "\n" << flush;
-#endif
-      throw bad_alloc();
-    }
-
-#ifdef FA_REPORT
-    ++totalops_;
-    if( ++current_ > highest_ ) highest_ = current_;
-#endif
-#ifdef FA_THREAD_SAFE
-    IntAtomicIncrement( *(long*)p );
-#else
-    *((long*)p) = 1L;
-#endif
-    return p+sizeof(long);
-  }
-
-  void Deallocate( void* p )
-  {
-    if( p == 0 )            // support "null-pointer, null-operation" semantics
-    {
-      return;
-    }
-
-    if( p < buf_ || p > buf_ + (n_+sizeof(long))*size )
-    {
-#ifdef FA_DEBUG
-      cout << "Bad Deallocate\n" << flush;
-#endif
-      throw bad_alloc();    // ensure we're not getting surprises
-    }
-
-#ifdef FA_REPORT
-    ++totalops_;
-    --current_;
-#endif
-#ifdef FA_DEBUG
-    if( *(long*)(((char*)p)-sizeof(long)) != 1 )
-    {
-      cout << "Bad Deallocate: double delete\n" << flush;
-    }
-#endif
-#ifdef FA_THREAD_SAFE
-    IntAtomicDecrement( *(long*)(((char*)p)-sizeof(long)) );
-#else
-    *(long*)(((char*)p)-sizeof(long)) = 0L;
-#endif
-  }
-
-private:
-  static const size_t size;
-
-  size_t n_;
-  char*  buf_;
-#ifdef FA_REPORT
-  size_t current_;  // # currently in use
-  size_t highest_;  // highest # currently in use
-  size_t totalops_; // total number of allocations/deallocations
-  const char* name_;
-#endif
-};
-
-const size_t FastArena::size = 100;   // # elements
-
-
+////////////////////////////////////////////////////////////////////////////////
+//
+// String Performance Tests Based on Herb Sutter's GotW #45.
+//
+// by Giovanni Dicanio <giovanni.dicanio@gmail.com>
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+//==============================================================================
+//
+//  Guru of the Week #45: Sample code, and performance test harness.
+//
+//  Version 2.0: Changes include the following:
+//
+//      - changed reference count from unsigned to long, and "unshareable"
+//          state is now flagged by a negative number
+//
+//      - changed IntAtomicGet to IntAtomicCompare
+//
+//      - inlined everything
+//
+//      - changed AboutToModify to EnsureUnique and EnsureUnshareable, in order
+//          to avoid passing the "bMarkUnshareable" bool as a runtime flag when
+//          this is after all known at compile time
+//
+//      - created fixed-size allocator (i.e., "fast allocator") for StringBuf
+//          to eliminate any issues related to double allocation penalties
+//
+//      - added non-COW test cases, including one that uses a fast allocator
+//          (the original version compared only various thread-safe and -unsafe
+//          flavours of COW, and didn't compare plain non-COW)
+//
+//      - added alternatively-optimized COW test cases, include COW_AtomicInt2
+//          that avoids a secondary allocation by using a single buffer for the
+//          len/used/refs values and the string data
+//
+//      - added native x86 assembler versions of the AtomicInt functions to
+//          show that the Win32 operations were equally efficient (no, there's
+//          no function-call overhead)
+//
+//      - added ability to test copying and Append, in addition to operator[],
+//          which also meant adding a function to shrink a string
+//
+//      - changed from calling copy to calling memcpy... on my compiler,
+//          memcpy was about three times faster (indicating that perhaps this
+//          implementation ought to specialize copy for builtin types), and
+//          the majority of COW's performance advantage came from avoiding the
+//          inefficient copy, not from avoiding the allocation
+//
+//      - a lot of miscellaneous things I probably forgot to document
+//
+//  Copyright (c) 1998 by H.P.Sutter. All rights reserved. You may download and
+//  compile and play with this code to your heart's content, but you may not
+//  redistribute it; instead, please just include a link to this code at the
+//  official GotW site.
+//
+//==============================================================================
+
+
+//------------------------------------------------------------------------------
+//
+//  Here are good (but mostly platform-specific) sample implementations for
+//  CriticalSection, Mutex, SpinLock, TicketLock, McsLock, FutexLock, StdMutex,
+//  IntAtomicXxx (Win32 and inline assembler), IntMaybeAtomicXxx, SeqCount,
+//  MpmcQueue, Timer, LatencyHistogram, Thread, StartGate, StealingFor,
+//  Scheduler, Stage, Channel, Stats, TscClock, TraceLog,
+//  StringProfiler, the instrumentation policies (NoInstr, CountInstr,
+//  TraceInstr, SampleInstr), CopyUsefulness, LiveStats, HeapCount, and
+//  FastArena.
+//
+//------------------------------------------------------------------------------
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <x86intrin.h>
+#include <condition_variable>
+#endif
+#include <string.h>
+#include <mutex>
+#include <deque>
+#if defined __cpp_impl_coroutine
+#include <coroutine>
+#include <optional>
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+//  Everywhere but Win32 (g++ or clang on x86 Linux, see the Makefile), the
+//  Win32 and MSVC names used here and in test.cpp, on top of the gcc
+//  builtins and POSIX. The classes that own a Win32 object (CriticalSection,
+//  Mutex, Timer, Thread, StartGate and LiveStats) have a POSIX branch of
+//  their own.
+//
+//------------------------------------------------------------------------------
+
+#ifndef _WIN32
+
+#define __declspec( x )     __attribute__(( x ))     // only ever noinline
+#define UNREFERENCED_PARAMETER( x )  (void)( x )
+
+inline long InterlockedIncrement( volatile long* p )
+{
+  return __atomic_add_fetch( p, 1, __ATOMIC_SEQ_CST );
+}
+
+inline long InterlockedDecrement( volatile long* p )
+{
+  return __atomic_sub_fetch( p, 1, __ATOMIC_SEQ_CST );
+}
+
+inline long InterlockedExchange( volatile long* p, long v )
+{
+  return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline long InterlockedExchangeAdd( volatile long* p, long v )
+{
+  return __atomic_fetch_add( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline long InterlockedCompareExchange( volatile long* p, long x, long comparand )
+{
+  __atomic_compare_exchange_n( p, &comparand, x, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+  return comparand;
+}
+
+inline void* InterlockedExchangePointer( void* volatile* p, void* v )
+{
+  return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline void* InterlockedCompareExchangePointer( void* volatile* p, void* x, void* comparand )
+{
+  __atomic_compare_exchange_n( p, &comparand, x, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+  return comparand;
+}
+
+#define _ReadWriteBarrier() __asm__ __volatile__( "" ::: "memory" )
+
+inline void YieldProcessor() { _mm_pause(); }
+inline void SwitchToThread() { sched_yield(); }
+
+inline void Sleep( unsigned long ms )
+{
+  if( ms == 0 )
+  {
+    sched_yield();
+    return;
+  }
+  timespec ts = { static_cast<time_t>( ms / 1000 ), static_cast<long>( ms % 1000 ) * 1000000 };
+  while( nanosleep( &ts, &ts ) != 0 )
+  {
+  }
+}
+
+//  FutexLock's waits, on the futex that is the low half of its state (x86
+//  is little-endian, and the state never leaves 0 to 2).
+//
+inline void WaitOnAddress( volatile long* p, long* compare, size_t, unsigned long )
+{
+  syscall( SYS_futex, reinterpret_cast<volatile int*>( p ), FUTEX_WAIT_PRIVATE, static_cast<int>( *compare ), 0, 0, 0 );
+}
+
+inline void WakeByAddressSingle( void* p )
+{
+  syscall( SYS_futex, static_cast<int*>( p ), FUTEX_WAKE_PRIVATE, 1, 0, 0, 0 );
+}
+
+const unsigned long INFINITE = ~0ul;
+
+inline void* _aligned_malloc( size_t n, size_t alignment )
+{
+  void* p = 0;
+  return posix_memalign( &p, max( alignment, sizeof(void*) ), n ) == 0 ? p : 0;
+}
+
+inline void _aligned_free( void* p ) { free( p ); }
+
+inline size_t _msize( void* p ) { return malloc_usable_size( p ); }
+
+#endif
+
+
+//------------------------------------------------------------------------------
+
+//  Helper class to ensure locks are acquired and released in pairs, even in
+//  the presence of exceptions.
+//
+template<class T>
+class Lock
+{
+public:
+  Lock( T& t )
+    : t_(t),
+      bLocked_(true)
+  {
+    t_.Lock();
+  }
+
+ ~Lock() {
+    Unlock();
+  }
+
+  void Unlock() {
+    if( bLocked_ ) {
+      t_.Unlock();
+      bLocked_ = false;
+    }
+  }
+private:
+  T& t_;
+  bool bLocked_;
+};
+
+#ifdef _WIN32
+
+class CriticalSection
+{
+public:
+  CriticalSection() { InitializeCriticalSection( &cs_ ); }
+private:
+  friend class ::Lock<CriticalSection>;
+  void Lock()       { EnterCriticalSection( &cs_ ); }
+  void Unlock()     { LeaveCriticalSection( &cs_ ); }
+  CRITICAL_SECTION cs_;
+};
+
+class Mutex
+{
+public:
+  Mutex()
+   : m_(0)
+  {
+    SECURITY_ATTRIBUTES sec;
+    sec.nLength = sizeof( sec );
+    sec.lpSecurityDescriptor = 0;
+    sec.bInheritHandle = false;
+    m_ = CreateMutex( &sec, false, L"" );
+  }
+
+  ~Mutex()
+  {
+    if( m_ )
+    {
+      CloseHandle(m_);
+      m_ = 0;
+    }
+  }
+
+private:
+  friend class ::Lock<Mutex>;
+  void Lock()     { WaitForSingleObject( m_, INFINITE ); }
+  void Unlock()   { ReleaseMutex( m_ ); }
+  HANDLE m_;
+};
+
+#else
+
+//  A CRITICAL_SECTION spins a little in user mode before it waits in the
+//  kernel, as glibc's adaptive mutex does. A Win32 mutex always goes to the
+//  kernel, which the nearest POSIX thing, a process-shared pthread mutex,
+//  doesn't, so Mutex is a plain pthread mutex.
+//
+class CriticalSection
+{
+public:
+  CriticalSection()
+  {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_ADAPTIVE_NP );
+    pthread_mutex_init( &m_, &attr );
+    pthread_mutexattr_destroy( &attr );
+  }
+ ~CriticalSection() { pthread_mutex_destroy( &m_ ); }
+private:
+  CriticalSection( const CriticalSection& );
+  void operator=( const CriticalSection& );
+
+  friend class ::Lock<CriticalSection>;
+  void Lock()       { pthread_mutex_lock( &m_ ); }
+  void Unlock()     { pthread_mutex_unlock( &m_ ); }
+  pthread_mutex_t m_;
+};
+
+class Mutex
+{
+public:
+  Mutex()           { pthread_mutex_init( &m_, 0 ); }
+ ~Mutex()           { pthread_mutex_destroy( &m_ ); }
+private:
+  Mutex( const Mutex& );
+  void operator=( const Mutex& );
+
+  friend class ::Lock<Mutex>;
+  void Lock()       { pthread_mutex_lock( &m_ ); }
+  void Unlock()     { pthread_mutex_unlock( &m_ ); }
+  pthread_mutex_t m_;
+};
+
+#endif
+
+
+//------------------------------------------------------------------------------
+//
+//  More locks for Lock<T>, from the simplest spin to a queue lock. All of them
+//  are small enough to embed in each StringBuf, like the two above.
+
+//  One step of a busy-wait: pause for a while, then start giving the CPU away,
+//  in case whoever we're waiting for has been preempted and can't run until
+//  we do. Without that, a spinning waiter can burn its whole time slice when
+//  there are more runnable threads than cores.
+//
+inline void SpinWait( int& spins )
+{
+  if( ++spins < 1000 )
+  {
+    YieldProcessor();
+  }
+  else
+  {
+    SwitchToThread();
+  }
+}
+
+//  Test-and-test-and-set spinlock: waiters spin on a plain read, which stays in
+//  their own cache, and only try the interlocked exchange once it looks free.
+//
+class SpinLock
+{
+public:
+  SpinLock() : locked_(0) { }
+private:
+  SpinLock( const SpinLock& );
+  void operator=( const SpinLock& );
+
+  friend class ::Lock<SpinLock>;
+  void Lock()
+  {
+    int spins = 0;
+    while( InterlockedExchange( &locked_, 1 ) != 0 )
+    {
+      while( locked_ )
+      {
+        SpinWait( spins );
+      }
+    }
+  }
+  void Unlock()     { _ReadWriteBarrier(); locked_ = 0; }
+  volatile long locked_;
+};
+
+//  Ticket lock: FIFO, so no waiter can starve, but every waiter spins on the
+//  same now-serving count and they all see the cache line move on each handoff.
+//
+class TicketLock
+{
+public:
+  TicketLock() : next_(0), serving_(0) { }
+private:
+  TicketLock( const TicketLock& );
+  void operator=( const TicketLock& );
+
+  friend class ::Lock<TicketLock>;
+  void Lock()
+  {
+    int  spins  = 0;
+    long ticket = InterlockedExchangeAdd( &next_, 1 );
+    while( serving_ != ticket )
+    {
+      SpinWait( spins );
+    }
+  }
+  void Unlock()     { _ReadWriteBarrier(); serving_ = serving_ + 1; }
+  volatile long next_;
+  volatile long serving_;
+};
+
+//  MCS queue lock: FIFO like the ticket lock, but each waiter spins on a flag
+//  in its own queue node, so a handoff touches only the next waiter's line.
+//  Nodes come from a small per-thread stack, which assumes a thread releases
+//  the MCS locks it holds in reverse order of taking them (as Lock<T> does).
+//
+class McsLock
+{
+public:
+  McsLock() : tail_(0), owner_(0) { }
+private:
+  McsLock( const McsLock& );
+  void operator=( const McsLock& );
+
+  struct Node {
+    Node* volatile next;
+    volatile long  locked;
+  };
+
+  enum { nNodes = 8 };  // most MCS locks one thread can hold at once
+
+  static Node* PushNode() {
+    static thread_local Node nodes[nNodes];
+    if( Depth() == nNodes ) {
+      cout << "McsLock: more than " << nNodes << " held by one thread\n" << flush;
+      abort();
+    }
+    return &nodes[Depth()++];
+  }
+  static void  PopNode()  { --Depth(); }
+  static int&  Depth()    { static thread_local int depth; return depth; }
+
+  friend class ::Lock<McsLock>;
+  void Lock()
+  {
+    Node* me = PushNode();
+    me->next   = 0;
+    me->locked = 1;
+    Node* pred = (Node*)InterlockedExchangePointer( (void* volatile*)&tail_, me );
+    if( pred )
+    {
+      int spins = 0;
+      pred->next = me;
+      while( me->locked )
+      {
+        SpinWait( spins );
+      }
+    }
+    owner_ = me;
+  }
+  void Unlock()
+  {
+    Node* me = owner_;
+    if( !me->next )
+    {
+      if( InterlockedCompareExchangePointer( (void* volatile*)&tail_, 0, me ) == me )
+      {
+        PopNode();
+        return;
+      }
+      int spins = 0;
+      while( !me->next )  // a successor is between its exchange and linking in
+      {
+        SpinWait( spins );
+      }
+    }
+    _ReadWriteBarrier();
+    me->next->locked = 0;
+    PopNode();
+  }
+  Node* volatile tail_;
+  Node*          owner_;  // only touched by the holder
+};
+
+//  A futex-style mutex (Drepper's "Futexes Are Tricky" mutex 2) on top of
+//  WaitOnAddress: 0 = free, 1 = held, 2 = held with possible waiters. An
+//  uncontended Lock/Unlock is one interlocked op each, with no kernel call.
+//  Needs Windows 8 or later; elsewhere it's a Linux futex.
+//
+#ifdef _MSC_VER
+#pragma comment( lib, "Synchronization.lib" )
+#endif
+
+class FutexLock
+{
+public:
+  FutexLock() : state_(0) { }
+private:
+  FutexLock( const FutexLock& );
+  void operator=( const FutexLock& );
+
+  friend class ::Lock<FutexLock>;
+  void Lock()
+  {
+    long c = InterlockedCompareExchange( &state_, 1, 0 );
+    if( c == 0 )
+    {
+      return;
+    }
+    if( c != 2 )
+    {
+      c = InterlockedExchange( &state_, 2 );
+    }
+    while( c != 0 )
+    {
+      long contended = 2;
+      WaitOnAddress( &state_, &contended, sizeof(state_), INFINITE );
+      c = InterlockedExchange( &state_, 2 );
+    }
+  }
+  void Unlock()
+  {
+    if( InterlockedDecrement( &state_ ) != 0 )
+    {
+      state_ = 0;
+      WakeByAddressSingle( (void*)&state_ );
+    }
+  }
+  volatile long state_;
+};
+
+//  The standard library's mutex, for comparison with the hand-made ones.
+//
+class StdMutex
+{
+private:
+  friend class ::Lock<StdMutex>;
+  void Lock()       { m_.lock(); }
+  void Unlock()     { m_.unlock(); }
+  std::mutex m_;
+};
+
+
+//------------------------------------------------------------------------------
+
+//  Odd... for some reason InterlockedExchangeAdd is not available in
+//  Windows 95, so this code won't run on that OS. It's available under
+//  Windows 98 and NT, though. Oh well.
+//
+inline long IntAtomicCompare( long& i, long v )
+{
+  long ii = InterlockedExchangeAdd( &i, 0 );
+  return ( (ii) < (v) ? -1 : ( (ii) == (v) ? 0 : 1 ) );
+}
+inline long IntAtomicIncrement( long& i ) { return InterlockedIncrement( &i ); }
+inline long IntAtomicDecrement( long& i ) { return InterlockedDecrement( &i ); }
+
+//  Stores x into i if i equals comparand; returns the original value of i.
+//
+inline long IntAtomicCompareExchange( long& i, long x, long comparand )
+{
+  return InterlockedCompareExchange( &i, x, comparand );
+}
+
+//  Set, for good, just before the first Thread (below) starts, the way
+//  libstdc++'s __gthread_active_p notices that a program has gone threaded.
+//  Until then nobody else can be looking at a reference count, so the
+//  IntMaybeAtomicXxx versions update it with plain instructions. Threads
+//  started other than through Thread aren't noticed.
+//
+inline volatile long& ThreadsStarted()
+{
+  static volatile long started;
+  return started;
+}
+
+inline long IntMaybeAtomicCompare( long& i, long v )
+{
+  if( ThreadsStarted() )
+  {
+    return IntAtomicCompare( i, v );
+  }
+  return ( (i) < (v) ? -1 : ( (i) == (v) ? 0 : 1 ) );
+}
+inline long IntMaybeAtomicIncrement( long& i ) { return ThreadsStarted() ? IntAtomicIncrement( i ) : ++i; }
+inline long IntMaybeAtomicDecrement( long& i ) { return ThreadsStarted() ? IntAtomicDecrement( i ) : --i; }
+
+//  Reference count policies for the COW_AtomicInt2 family (cow-atomic-test.h
+//  in TestCowStrings): Count is the type of StringBuf::refs, Decrement returns
+//  the new count, and Compare works like IntAtomicCompare. Shareable is the
+//  copy constructor's check for an unshareable (negative) count.
+//
+struct AtomicRefs
+{
+  typedef long Count;
+  static void Init( Count& c, long v )      { c = v; }
+  static void Set( Count& c, long v )       { c = v; }
+  static void Increment( Count& c )         { IntAtomicIncrement( c ); }
+  static long Decrement( Count& c )         { return IntAtomicDecrement( c ); }
+  static long Compare( Count& c, long v )   { return IntAtomicCompare( c, v ); }
+  static bool Shareable( Count& c )         { return IntAtomicCompare( c, 0 ) > 0; }
+};
+
+struct MaybeAtomicRefs
+{
+  typedef long Count;
+  static void Init( Count& c, long v )      { c = v; }
+  static void Set( Count& c, long v )       { c = v; }
+  static void Increment( Count& c )         { IntMaybeAtomicIncrement( c ); }
+  static long Decrement( Count& c )         { return IntMaybeAtomicDecrement( c ); }
+  static long Compare( Count& c, long v )   { return IntMaybeAtomicCompare( c, v ); }
+  static bool Shareable( Count& c )         { return IntMaybeAtomicCompare( c, 0 ) > 0; }
+};
+
+
+//------------------------------------------------------------------------------
+
+//  Sequence counter for a seqlock. A writer makes the count odd for the whole
+//  of its update (WriteBegin also excludes other writers, by only ever moving
+//  the count from even to odd), and a reader that saw an odd count, or a count
+//  that changed while it was reading, just retries. Readers never write to
+//  shared memory.
+//
+class SeqCount
+{
+public:
+  SeqCount() : seq_(0) { }
+
+  long ReadBegin() const
+  {
+    long s;
+    int  spins = 0;
+    while( (s = seq_) & 1 )
+    {
+      SpinWait( spins );
+    }
+    _ReadWriteBarrier();  // the protected reads must come after this load
+    return s;
+  }
+
+  bool ReadRetry( long s ) const
+  {
+    _ReadWriteBarrier();  // ...and before this one
+    return seq_ != s;
+  }
+
+  void WriteBegin()
+  {
+    for( int spins = 0; ; )
+    {
+      long s = seq_;
+      if( !(s & 1) && InterlockedCompareExchange( &seq_, s+1, s ) == s )
+      {
+        return;
+      }
+      SpinWait( spins );
+    }
+  }
+
+  void WriteEnd() { InterlockedIncrement( &seq_ ); }
+
+private:
+  volatile long seq_;
+};
+
+
+
+//  new[] and delete[] for an alignas(64) type. Plain new[] only honours more
+//  than the default alignment from C++17 on, so the memory comes from
+//  _aligned_malloc and the elements are constructed in place.
+//
+template<class T>
+T* NewAligned( size_t n )
+{
+  T* t = static_cast<T*>( _aligned_malloc( n * sizeof(T), alignof(T) ) );
+  if( !t )
+  {
+    throw bad_alloc();
+  }
+  size_t i = 0;
+  try
+  {
+    for( ; i < n; ++i )
+    {
+      new( t + i ) T();
+    }
+  }
+  catch( ... )
+  {
+    while( i > 0 )
+    {
+      t[--i].~T();
+    }
+    _aligned_free( t );
+    throw;
+  }
+  return t;
+}
+
+template<class T>
+void DeleteAligned( T* t, size_t n )
+{
+  if( t )
+  {
+    for( size_t i = n; i > 0; --i )
+    {
+      t[i-1].~T();
+    }
+    _aligned_free( t );
+  }
+}
+
+
+//  Bounded multi-producer multi-consumer queue (Dmitry Vyukov's): a ring of
+//  capacity cells, each with a sequence number saying whose turn it is. A
+//  producer may fill the cell at head_ once its sequence equals head_, and
+//  sets it to head_+1 when the item is in; a consumer may empty the cell at
+//  tail_ once its sequence is tail_+1, and sets it to tail_+capacity, ready
+//  for the producer one lap later. Claiming a cell is one compare-exchange on
+//  head_ or tail_, so nobody ever waits for a thread that got preempted
+//  holding a lock. Push and Pop return false when the queue is full or empty.
+//
+//  Items are constructed in the cell and destroyed there after Pop has shown
+//  them to the caller, so T needs no assignment.
+//
+template<class T>
+class MpmcQueue
+{
+public:
+  explicit MpmcQueue( long capacity )   // a power of 2
+    : cells_( NewAligned<Cell>( capacity ) ), mask_( capacity-1 ), head_( 0 ), tail_( 0 )
+  {
+    for( long i = 0; i < capacity; ++i )
+    {
+      cells_[i].seq = i;
+    }
+  }
+
+ ~MpmcQueue()
+  {
+    Discard discard;
+    while( Pop( discard ) )
+    {
+    }
+    DeleteAligned( cells_, static_cast<size_t>( mask_ ) + 1 );
+  }
+
+  //  Copies v into the queue, or moves it if it's an rvalue.
+  template<class U>
+  bool Push( U&& v )
+  {
+    Cell* c;
+    long  pos = head_;
+    for( ;; )
+    {
+      c = &cells_[ pos & mask_ ];
+      long dif = Diff( c->seq, pos );
+      _ReadWriteBarrier();
+      if( dif == 0 )
+      {
+        if( InterlockedCompareExchange( &head_, Add( pos, 1 ), pos ) == pos )
+        {
+          break;
+        }
+      }
+      else if( dif < 0 )
+      {
+        return false;   // full
+      }
+      pos = head_;
+    }
+    new( c->item ) T( std::forward<U>( v ) );
+    _ReadWriteBarrier();
+    c->seq = Add( pos, 1 );
+    return true;
+  }
+
+  //  Calls f( item ) on the oldest item, then destroys it.
+  template<class F>
+  bool Pop( F& f )
+  {
+    Cell* c;
+    long  pos = tail_;
+    for( ;; )
+    {
+      c = &cells_[ pos & mask_ ];
+      long dif = Diff( c->seq, Add( pos, 1 ) );
+      _ReadWriteBarrier();
+      if( dif == 0 )
+      {
+        if( InterlockedCompareExchange( &tail_, Add( pos, 1 ), pos ) == pos )
+        {
+          break;
+        }
+      }
+      else if( dif < 0 )
+      {
+        return false;   // empty
+      }
+      pos = tail_;
+    }
+    T* item = reinterpret_cast<T*>( c->item );
+    f( *item );
+    item->~T();
+    _ReadWriteBarrier();
+    c->seq = Add( pos, mask_+1 );
+    return true;
+  }
+
+private:
+  MpmcQueue( const MpmcQueue& );
+  void operator=( const MpmcQueue& );
+
+  struct alignas(64) Cell
+  {
+    volatile long seq;
+    alignas(T) char item[sizeof(T)];
+  };
+
+  struct Discard
+  {
+    void operator()( T& ) { }
+  };
+
+  //  Positions wrap around, so they're added and compared as unsigned.
+  static long Add( long a, long b )  { return static_cast<long>( static_cast<unsigned long>(a) + static_cast<unsigned long>(b) ); }
+  static long Diff( long a, long b ) { return static_cast<long>( static_cast<unsigned long>(a) - static_cast<unsigned long>(b) ); }
+
+  Cell*                  cells_;
+  long                   mask_;
+  alignas(64) volatile long head_;   // producers' side
+  alignas(64) volatile long tail_;   // consumers' side
+};
+
+
+//------------------------------------------------------------------------------
+
+class Timer
+{
+public:
+  Timer() : _start( PerfCounter() ) { }
+  
+  int Elapsed() // milliseconds 
+  { 
+      const long long finish = PerfCounter();
+
+      double elapsedMilliseconds = ((finish - _start) * 1000.0) / PerfFrequency();
+
+      return static_cast<int>(elapsedMilliseconds);
+  }
+
+  // Raw timestamps, for timing many short operations without a Timer each
+  static long long Ticks() { return PerfCounter(); }
+
+  static double NsPerTick()
+  {
+      static const double ns = 1e9 / PerfFrequency();
+      return ns;
+  }
+
+private:
+  const long long _start;
+
+#ifdef _WIN32
+  static long long PerfCounter()
+  {
+      LARGE_INTEGER li;
+      QueryPerformanceCounter(&li);
+      return li.QuadPart;
+  }
+
+  static long long PerfFrequency()
+  {
+      LARGE_INTEGER li;
+      QueryPerformanceFrequency(&li);
+      return li.QuadPart;
+  }
+#else
+  static long long PerfCounter()
+  {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+  }
+
+  static long long PerfFrequency()
+  {
+      return 1000000000LL;
+  }
+#endif
+
+};
+
+
+//------------------------------------------------------------------------------
+
+//  Latency histogram with 8 buckets per power of two, so each bucket is within
+//  12.5% of its neighbours, from 1ns to centuries. One per thread; Merge them
+//  afterwards.
+//
+class LatencyHistogram
+{
+public:
+  LatencyHistogram() : n_(0), max_(0)
+  {
+    memset( counts_, 0, sizeof(counts_) );
+  }
+
+  void Add( long long ns )
+  {
+    ++counts_[ Bucket( ns ) ];
+    ++n_;
+    if( ns > max_ ) max_ = ns;
+  }
+
+  void Merge( const LatencyHistogram& other )
+  {
+    for( int b = 0; b < nBuckets; ++b )
+    {
+      counts_[b] += other.counts_[b];
+    }
+    n_ += other.n_;
+    if( other.max_ > max_ ) max_ = other.max_;
+  }
+
+  long long Count() const { return n_; }
+  long long Max() const   { return max_; }
+
+  //  Upper bound of the bucket holding the p-th percentile (0 < p <= 100).
+  long long Percentile( double p ) const
+  {
+    long long rank = static_cast<long long>( n_ * p / 100.0 + 0.5 ), seen = 0;
+    for( int b = 0; b < nBuckets; ++b )
+    {
+      if( (seen += counts_[b]) >= rank && seen > 0 )
+      {
+        return min( UpperBound( b ), max_ );
+      }
+    }
+    return max_;
+  }
+
+private:
+  enum { nSub = 8, nBuckets = 64*nSub };
+
+  static int Bucket( long long ns )
+  {
+    if( ns < nSub ) return ns < 0 ? 0 : static_cast<int>(ns);
+    int msb = 3;
+    while( ns >> (msb+1) ) ++msb;
+    return (msb-2)*nSub + static_cast<int>( (ns >> (msb-3)) & (nSub-1) );
+  }
+
+  static long long UpperBound( int b )
+  {
+    if( b < nSub ) return b;
+    int msb = b/nSub + 2;
+    return ( (long long)(nSub + b%nSub) << (msb-3) ) + ( 1LL << (msb-3) ) - 1;
+  }
+
+  long long counts_[nBuckets];
+  long long n_;
+  long long max_;
+};
+
+
+//------------------------------------------------------------------------------
+
+//  Runs t.Run() on a new thread; Join (or the destructor) waits for it to end.
+//  Given a cpu, the thread only ever runs on that logical processor (of the
+//  first 64, i.e. of the calling thread's processor group): it's created
+//  suspended and pinned before it starts.
+//
+#ifdef _WIN32
+
+template<class T>
+class Thread
+{
+public:
+  Thread( T& t, int cpu = -1 )
+    : h_( ( ThreadsStarted() = 1, CreateThread( 0, 0, &Thread::Start, &t, CREATE_SUSPENDED, 0 ) ) )
+  {
+    if( cpu >= 0 ) {
+      SetThreadAffinityMask( h_, static_cast<DWORD_PTR>(1) << ( cpu % 64 ) );
+    }
+    ResumeThread( h_ );
+  }
+
+ ~Thread() {
+    Join();
+  }
+
+  void Join() {
+    if( h_ ) {
+      WaitForSingleObject( h_, INFINITE );
+      CloseHandle( h_ );
+      h_ = 0;
+    }
+  }
+
+private:
+  Thread( const Thread& );
+  void operator=( const Thread& );
+
+  static DWORD WINAPI Start( void* p ) {
+    static_cast<T*>(p)->Run();
+    return 0;
+  }
+
+  HANDLE h_;
+};
+
+#else
+
+//  The pinned thread gets its cpu set in its attributes, so it too never
+//  runs anywhere else.
+//
+template<class T>
+class Thread
+{
+public:
+  Thread( T& t, int cpu = -1 )
+    : bJoinable_( false )
+  {
+    ThreadsStarted() = 1;
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    if( cpu >= 0 ) {
+      cpu_set_t cpus;
+      CPU_ZERO( &cpus );
+      CPU_SET( cpu % CPU_SETSIZE, &cpus );
+      pthread_attr_setaffinity_np( &attr, sizeof(cpus), &cpus );
+    }
+    bJoinable_ = pthread_create( &t_, &attr, &Thread::Start, &t ) == 0;
+    pthread_attr_destroy( &attr );
+  }
+
+ ~Thread() {
+    Join();
+  }
+
+  void Join() {
+    if( bJoinable_ ) {
+      pthread_join( t_, 0 );
+      bJoinable_ = false;
+    }
+  }
+
+private:
+  Thread( const Thread& );
+  void operator=( const Thread& );
+
+  static void* Start( void* p ) {
+    static_cast<T*>(p)->Run();
+    return 0;
+  }
+
+  pthread_t t_;
+  bool      bJoinable_;
+};
+
+#endif
+
+//  Holds a group of threads until Open() is called, so that they all start
+//  their timed work together rather than as each one happens to be created.
+//
+#ifdef _WIN32
+
+class StartGate
+{
+public:
+  StartGate()  : e_( CreateEvent( 0, TRUE, FALSE, 0 ) ) { }
+ ~StartGate()  { CloseHandle( e_ ); }
+
+  void Open()  { SetEvent( e_ ); }
+  void Wait()  { WaitForSingleObject( e_, INFINITE ); }
+
+private:
+  StartGate( const StartGate& );
+  void operator=( const StartGate& );
+
+  HANDLE e_;
+};
+
+inline int HardwareThreads()
+{
+  SYSTEM_INFO si;
+  GetSystemInfo( &si );
+  return static_cast<int>( si.dwNumberOfProcessors );
+}
+
+#else
+
+class StartGate
+{
+public:
+  StartGate()  : bOpen_( false ) { }
+
+  void Open()
+  {
+    lock_guard<mutex> lock( m_ );
+    bOpen_ = true;
+    cv_.notify_all();
+  }
+
+  void Wait()
+  {
+    unique_lock<mutex> lock( m_ );
+    cv_.wait( lock, [this] { return bOpen_; } );
+  }
+
+private:
+  StartGate( const StartGate& );
+  void operator=( const StartGate& );
+
+  mutex              m_;
+  condition_variable cv_;
+  bool               bOpen_;
+};
+
+inline int HardwareThreads()
+{
+  return static_cast<int>( sysconf( _SC_NPROCESSORS_ONLN ) );
+}
+
+#endif
+
+
+//  Runs body( worker, begin, end ) over [0, n) on nWorkers threads, with work
+//  stealing. Each worker has its own deque of ranges. It takes the newest
+//  range from the back of its deque and splits it, pushing the upper half
+//  back, until it's down to grain items, which it runs. A worker whose deque
+//  is empty steals the oldest, and so the biggest, range from the front of
+//  another's. All the work starts as one range on worker 0, so the others
+//  start out stealing. Each deque is guarded by a SpinLock, which its owner
+//  takes once per split or run: cheap next to a grain of work.
+//
+template<class Body>
+class StealingFor
+{
+public:
+  StealingFor( Body& body, int nWorkers, long grain )
+    : body_( body ), nWorkers_( nWorkers ), grain_( grain ), queues_( NewAligned<Queue>( nWorkers ) ), left_( 0 )
+  {
+    for( int i = 0; i < nWorkers; ++i )
+    {
+      Worker w = { this, i, 0 };
+      workers_.push_back( w );
+    }
+  }
+
+ ~StealingFor() { DeleteAligned( queues_, static_cast<size_t>( nWorkers_ ) ); }
+
+  //  Returns the ms from opening the start gate until the last range is done.
+  int Run( long n )
+  {
+    left_ = n;
+    Push( 0, Range( 0, n ) );
+
+    vector<Thread<Worker>*> threads;
+    int i = 0;
+    for( i = 0; i < nWorkers_; ++i )
+    {
+      threads.push_back( new Thread<Worker>( workers_[i] ) );
+    }
+
+    Timer t;    // *** start timing
+    gate_.Open();
+    for( i = 0; i < nWorkers_; ++i )
+    {
+      delete threads[i];  // joins
+    }
+    return t.Elapsed();
+  }
+
+  long Steals() const
+  {
+    long steals = 0;
+    for( int i = 0; i < nWorkers_; ++i )
+    {
+      steals += workers_[i].steals;
+    }
+    return steals;
+  }
+
+private:
+  StealingFor( const StealingFor& );
+  void operator=( const StealingFor& );
+
+  typedef pair<long, long> Range;
+
+  struct alignas(64) Queue
+  {
+    Queue() : size( 0 ) { }
+
+    SpinLock      lock;
+    deque<Range>  ranges;
+    volatile long size;     // for thieves to peek at without the lock
+  };
+
+  struct Worker
+  {
+    StealingFor* pool;
+    int          index;
+    long         steals;
+
+    void Run()
+    {
+      pool->gate_.Wait();
+      int spins = 0;
+      while( pool->left_ > 0 )
+      {
+        Range r;
+        if( !pool->Pop( index, r ) && !pool->Steal( index, r, steals ) )
+        {
+          SpinWait( spins );
+          continue;
+        }
+        spins = 0;
+        while( r.second - r.first > pool->grain_ )
+        {
+          long mid = r.first + ( r.second - r.first ) / 2;
+          pool->Push( index, Range( mid, r.second ) );
+          r.second = mid;
+        }
+        pool->body_( index, r.first, r.second );
+        InterlockedExchangeAdd( &pool->left_, -( r.second - r.first ) );
+      }
+    }
+  };
+
+  void Push( int i, const Range& r )
+  {
+    Lock<SpinLock> l( queues_[i].lock );
+    queues_[i].ranges.push_back( r );
+    queues_[i].size = static_cast<long>( queues_[i].ranges.size() );
+  }
+
+  bool Pop( int i, Range& r )
+  {
+    Lock<SpinLock> l( queues_[i].lock );
+    if( queues_[i].ranges.empty() )
+    {
+      return false;
+    }
+    r = queues_[i].ranges.back();
+    queues_[i].ranges.pop_back();
+    queues_[i].size = static_cast<long>( queues_[i].ranges.size() );
+    return true;
+  }
+
+  bool Steal( int thief, Range& r, long& steals )
+  {
+    for( int k = 1; k < nWorkers_; ++k )
+    {
+      Queue& q = queues_[ ( thief + k ) % nWorkers_ ];
+      if( q.size == 0 )
+      {
+        continue;
+      }
+      Lock<SpinLock> l( q.lock );
+      if( !q.ranges.empty() )
+      {
+        r = q.ranges.front();
+        q.ranges.pop_front();
+        q.size = static_cast<long>( q.ranges.size() );
+        ++steals;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  Body&          body_;
+  int            nWorkers_;
+  long           grain_;
+  Queue*         queues_;
+  vector<Worker> workers_;
+  StartGate      gate_;
+  volatile long  left_;     // items not yet run
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  C++20 coroutines, for the pipeline scenario in test.cpp: a Scheduler that
+//  resumes ready coroutines one at a time on the calling thread, Stage (a
+//  coroutine that the Scheduler starts), and Channel, which carries one item
+//  at a time from one stage to the next. Only compiled where the compiler has
+//  coroutines (VS2019 16.8 with /std:c++latest, GCC 10 with -std=c++20).
+
+#if defined __cpp_impl_coroutine
+
+class Scheduler
+{
+public:
+  Scheduler() { }
+
+  void Ready( std::coroutine_handle<> h ) { ready_.push_back( h ); }
+
+  //  Resumes ready coroutines, oldest first, until none is left.
+  void Run()
+  {
+    while( !ready_.empty() )
+    {
+      std::coroutine_handle<> h = ready_.front();
+      ready_.pop_front();
+      h.resume();
+    }
+  }
+
+private:
+  Scheduler( const Scheduler& );
+  void operator=( const Scheduler& );
+
+  std::deque<std::coroutine_handle<> > ready_;
+};
+
+//  What a pipeline stage returns. It doesn't run until Start hands it to a
+//  Scheduler, and its frame lives until the Stage is destroyed.
+//
+class Stage
+{
+public:
+  struct promise_type
+  {
+    Stage get_return_object() { return Stage( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+    std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+    std::suspend_always final_suspend() noexcept   { return std::suspend_always(); }
+    void return_void() { }
+    void unhandled_exception() { std::terminate(); }
+  };
+
+ ~Stage() { h_.destroy(); }
+
+  void Start( Scheduler& s ) { s.Ready( h_ ); }
+  bool Done() const          { return h_.done(); }
+
+private:
+  explicit Stage( std::coroutine_handle<promise_type> h ) : h_( h ) { }
+  Stage( const Stage& );
+  void operator=( const Stage& );
+
+  std::coroutine_handle<promise_type> h_;
+};
+
+//  co_await Send( v ) copies v into the channel, or moves it for an rvalue,
+//  then lets the receiver run before the sender resumes: whatever the sender
+//  still holds stays alive while the receiver works on the item. If the
+//  channel is still full, the sender waits for the receiver to take the last
+//  one. co_await Receive() gives the item, moved out of the channel, or
+//  nothing once the channel is closed and empty.
+//
+//  The item is constructed in place and destroyed after the move, so T needs
+//  no assignment.
+//
+template<class T>
+class Channel
+{
+public:
+  class SendAwaiter
+  {
+  public:
+    SendAwaiter( Channel& c, const T* copy, T* move ) : c_( c ), copy_( copy ), move_( move ) { }
+
+    bool await_ready() const { return false; }
+    void await_suspend( std::coroutine_handle<> h )
+    {
+      h_ = h;
+      if( c_.full_ )
+      {
+        c_.sender_ = this;  // Take puts the item in
+      }
+      else
+      {
+        c_.Put( *this );
+      }
+    }
+    void await_resume() const { }
+
+  private:
+    friend class Channel;
+    Channel&                c_;
+    const T*                copy_;
+    T*                      move_;
+    std::coroutine_handle<> h_;
+  };
+
+  class ReceiveAwaiter
+  {
+  public:
+    explicit ReceiveAwaiter( Channel& c ) : c_( c ) { }
+
+    bool await_ready() const { return c_.full_ || c_.closed_; }
+    void await_suspend( std::coroutine_handle<> h ) { c_.receiver_ = h; }
+    std::optional<T> await_resume() { return c_.Take(); }
+
+  private:
+    Channel& c_;
+  };
+
+  explicit Channel( Scheduler& s ) : s_( s ), full_( false ), closed_( false ), sender_( 0 ) { }
+ ~Channel() { if( full_ ) Item()->~T(); }
+
+  SendAwaiter    Send( const T& v ) { return SendAwaiter( *this, &v, 0 ); }
+  SendAwaiter    Send( T&& v )      { return SendAwaiter( *this, 0, &v ); }
+  ReceiveAwaiter Receive()          { return ReceiveAwaiter( *this ); }
+
+  void Close()
+  {
+    closed_ = true;
+    Wake();
+  }
+
+private:
+  Channel( const Channel& );
+  void operator=( const Channel& );
+
+  T* Item() { return reinterpret_cast<T*>( item_ ); }
+
+  void Put( SendAwaiter& a )
+  {
+    if( a.move_ )
+    {
+      new( item_ ) T( std::move( *a.move_ ) );
+    }
+    else
+    {
+      new( item_ ) T( *a.copy_ );
+    }
+    full_ = true;
+    Wake();             // the receiver first,
+    s_.Ready( a.h_ );   // then the sender
+  }
+
+  std::optional<T> Take()
+  {
+    std::optional<T> r;
+    if( full_ )
+    {
+      r.emplace( std::move( *Item() ) );
+      Item()->~T();
+      full_ = false;
+      if( sender_ )
+      {
+        SendAwaiter* a = sender_;
+        sender_ = 0;
+        Put( *a );
+      }
+    }
+    return r;
+  }
+
+  void Wake()
+  {
+    if( receiver_ )
+    {
+      s_.Ready( receiver_ );
+      receiver_ = std::coroutine_handle<>();
+    }
+  }
+
+  Scheduler&              s_;
+  bool                    full_;
+  bool                    closed_;
+  SendAwaiter*            sender_;      // waiting for room
+  std::coroutine_handle<> receiver_;    // waiting for an item
+  alignas(T) char         item_[sizeof(T)];
+};
+
+#endif
+
+
+//------------------------------------------------------------------------------
+
+//  A small per-thread index, unique among the threads running at the time and
+//  handed back when the thread exits, for indexing per-thread data like the
+//  Stats blocks below. Past nMaxThreads live threads, the rest share the last
+//  slot (and their counts may then be a little off).
+//
+class ThreadSlot
+{
+public:
+  enum { nMaxThreads = 1024 };
+
+  static int Get()
+  {
+    static thread_local Holder h;
+    return h.slot;
+  }
+
+private:
+  struct Holder
+  {
+    Holder() : slot( nMaxThreads-1 )
+    {
+      for( int i = 0; i < nMaxThreads-1; ++i )
+      {
+        if( IntAtomicCompareExchange( Slots()[i], 1L, 0L ) == 0 )
+        {
+          slot = i;
+          break;
+        }
+      }
+    }
+   ~Holder()
+    {
+      if( slot < nMaxThreads-1 )
+      {
+        IntAtomicDecrement( Slots()[slot] );
+      }
+    }
+    int slot;
+  };
+
+  static long* Slots()
+  {
+    static long slots[nMaxThreads];
+    return slots;
+  }
+};
+
+//  Instrumentation counts for one String implementation. The counts are kept
+//  in a block per thread, each on its own cache line, so counting needs no
+//  interlocked ops and doesn't bounce a line between cores in the middle of a
+//  multi-threaded measurement; Total() adds the blocks up. Total() and Reset()
+//  are meant for when the threads being counted are done.
+//
+struct Counts
+{
+  long long copies;       // copy constructions
+  long long allocs;       // buffer allocations
+  long long deepCopies;   // characters copied into a separate new buffer
+  long long unshares;     // a mutator found the buffer shared, and cloned it
+  long long grows;        // Reserve moved a non-empty buffer to a bigger one
+  long long bytesCopied;  // chars memcpy'd by deep copies and grows
+  long long refsReads;    // a mutator read refs to find out if it was unique
+  long long moves;        // move constructions
+};
+
+class Stats
+{
+public:
+  Stats()   { Reset(); }
+
+  void OnCopy()                 { ++Local().copies; }
+  void OnAlloc()                { ++Local().allocs; }
+  void OnUnshare()              { ++Local().unshares; }
+  void OnDeepCopy( size_t n )   { Counts& c = Local(); ++c.deepCopies; c.bytesCopied += n; }
+  void OnGrow( size_t n )       { Counts& c = Local(); ++c.grows;      c.bytesCopied += n; }
+  void OnRefsRead()             { ++Local().refsReads; }
+  void OnMove()                 { ++Local().moves; }
+
+  Counts Total() const
+  {
+    Counts t = Counts();
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      const Counts& c = blocks_[i].counts;
+      t.copies      += c.copies;
+      t.allocs      += c.allocs;
+      t.deepCopies  += c.deepCopies;
+      t.unshares    += c.unshares;
+      t.grows       += c.grows;
+      t.bytesCopied += c.bytesCopied;
+      t.refsReads   += c.refsReads;
+      t.moves       += c.moves;
+    }
+    return t;
+  }
+
+  void Reset()
+  {
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      blocks_[i].counts = Counts();
+    }
+  }
+
+private:
+  Counts& Local() { return blocks_[ ThreadSlot::Get() ].counts; }
+
+  struct alignas(64) Block
+  {
+    Counts counts;
+  };
+  Block blocks_[ThreadSlot::nMaxThreads];
+};
+
+
+//  __rdtsc rate, measured against Timer from the first Start() to each
+//  TicksPerNs() call: the longer the run in between, the closer it gets.
+//
+class TscClock
+{
+public:
+  static void Start()
+  {
+    StartTicks();
+    StartTsc();
+  }
+
+  static double TicksPerNs()
+  {
+    long long          t0   = StartTicks();
+    unsigned long long tsc0 = StartTsc();
+    long long          t    = Timer::Ticks();
+    unsigned long long tsc  = __rdtsc();
+    return t > t0 ? ( tsc - tsc0 ) / ( ( t - t0 ) * Timer::NsPerTick() ) : 1.0;
+  }
+
+private:
+  static long long StartTicks()
+  {
+    static const long long t0 = Timer::Ticks();
+    return t0;
+  }
+
+  static unsigned long long StartTsc()
+  {
+    static const unsigned long long tsc0 = __rdtsc();
+    return tsc0;
+  }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Event trace: a ring buffer per thread slot of the last nTraceEvents String
+//  events, each with a timestamp (__rdtsc, which is cheaper than
+//  QueryPerformanceCounter) and a size. Recording is a few plain stores into
+//  the calling thread's own buffer. A ring is allocated on the first event its
+//  slot records and kept for the life of the process, so the events of
+//  threads that have since exited are still there to look at.
+//
+//  Phase( name ) records a marker, so a trace can be cut into the phases of
+//  whatever scenario produced it. Dump writes the header, the phase names and
+//  then each ring's events, oldest first, to a binary file (see AnalyzeTrace
+//  in test.cpp for the reader). Only Dump or Reset once the recording threads
+//  are done; neither one locks.
+
+enum TraceEventType
+{
+  evCopy,           // copy construction
+  evShare,          // a copy shares the other's buffer
+  evAlloc,          // size = bytes allocated
+  evDeepCopy,       // size = chars copied into a new buffer
+  evUnshare,        // a mutator cloned a shared buffer
+  evUnshareable,    // a buffer was marked unshareable (operator[])
+  evGrow,           // size = chars moved to a bigger buffer
+  evFree,           // size = capacity of the freed buffer, where known
+  evPhase,          // size = index of the phase name
+  nTraceEventTypes
+};
+
+struct TraceEvent
+{
+  unsigned long long ticks;
+  unsigned int       size;
+  unsigned short     type;
+  unsigned short     slot;  // ThreadSlot of the recording thread
+};
+
+struct TraceFileHeader
+{
+  char         magic[4];    // "COWT"
+  unsigned int version;
+  unsigned int nPhases;     // followed by nPhases names of nMaxPhaseName chars
+  unsigned int nEvents;     //  and then nEvents TraceEvents
+  double       ticksPerNs;  // __rdtsc rate, measured against Timer
+};
+
+class TraceLog
+{
+public:
+  enum { nTraceEvents  = 1 << 20 };  // per thread slot; a power of 2
+  enum { nMaxPhases    = 256 };
+  enum { nMaxPhaseName = 48 };
+  enum { nVersion      = 1 };
+
+  struct Ring
+  {
+    unsigned long long next;        // total events ever recorded here
+    TraceEvent         events[nTraceEvents];
+  };
+
+  static void Record( TraceEventType type, size_t size )
+  {
+    int   slot = ThreadSlot::Get();
+    Ring* r    = Rings()[slot];
+    if( !r )
+    {
+      r = NewRing( slot );
+    }
+    TraceEvent& e = r->events[ r->next++ & (nTraceEvents-1) ];
+    e.ticks = __rdtsc();
+    e.size  = static_cast<unsigned int>( size );
+    e.type  = static_cast<unsigned short>( type );
+    e.slot  = static_cast<unsigned short>( slot );
+  }
+
+  //  Marks the start of a phase; the name is copied (and truncated to fit).
+  static void Phase( const char* name )
+  {
+    Phases& ph = GetPhases();
+    unsigned int i = ph.n < nMaxPhases ? ph.n++ : nMaxPhases-1;
+    size_t len = min( strlen( name ), static_cast<size_t>(nMaxPhaseName-1) );
+    memcpy( ph.names[i], name, len );
+    ph.names[i][len] = 0;
+    Record( evPhase, i );
+  }
+
+  //  Ring for thread slot i, or 0 if that slot hasn't recorded anything.
+  static Ring* Get( int i ) { return Rings()[i]; }
+
+  //  Forgets all events and phases; the rings stay allocated.
+  static void Reset()
+  {
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      if( Rings()[i] )
+      {
+        Rings()[i]->next = 0;
+      }
+    }
+    GetPhases().n = 0;
+  }
+
+  //  Writes every ring to file; returns the number of events written.
+  static unsigned int Dump( const char* file )
+  {
+    TraceFileHeader h = { { 'C', 'O', 'W', 'T' }, nVersion, GetPhases().n, 0, TscClock::TicksPerNs() };
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      h.nEvents += static_cast<unsigned int>( Held( i ) );
+    }
+
+    ofstream f( file, ios::binary );
+    f.write( reinterpret_cast<const char*>( &h ), sizeof(h) );
+    f.write( GetPhases().names[0], h.nPhases * nMaxPhaseName );
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      unsigned long long held = Held( i );
+      for( unsigned long long k = Rings()[i] ? Rings()[i]->next - held : 0; held--; ++k )
+      {
+        f.write( reinterpret_cast<const char*>( &Rings()[i]->events[ k & (nTraceEvents-1) ] ),
+                 sizeof(TraceEvent) );
+      }
+    }
+    return f ? h.nEvents : 0;
+  }
+
+private:
+  struct Phases
+  {
+    unsigned int n;
+    char         names[nMaxPhases][nMaxPhaseName];
+  };
+
+  static Ring** Rings()
+  {
+    static Ring* rings[ThreadSlot::nMaxThreads];
+    return rings;
+  }
+
+  static Phases& GetPhases()
+  {
+    static Phases phases;
+    return phases;
+  }
+
+  //  The first ring also starts the clock that TicksPerNs calibrates against.
+  static Ring* NewRing( int slot )
+  {
+    TscClock::Start();
+    return Rings()[slot] = new Ring();
+  }
+
+  static unsigned long long Held( int i )
+  {
+    return Rings()[i] ? min( Rings()[i]->next, static_cast<unsigned long long>(nTraceEvents) ) : 0;
+  }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Instrumentation policies. Each String implementation is a template on one
+//  of these and calls its hooks, with the String's Stats, wherever something
+//  worth counting happens; each namespace has these typedefs:
+//
+//    String         BasicString<NoInstr>      the hooks are empty inline
+//                                             functions, so the compiler is
+//                                             left with nothing to emit: this
+//                                             is the one the tests time
+//    CountedString  BasicString<CountInstr>   counts in Stats
+//    TracedString   BasicString<TraceInstr>   counts and records each event
+//                                             in TraceLog
+//    SampledString  BasicString<SampleInstr>  samples events for
+//                                             StringProfiler (below)
+//
+//  The policies are stateless, so none of them change a String's layout.
+
+struct NoInstr
+{
+  static void OnCopy( Stats& )                  { }
+  static void OnShare( Stats& )                 { }
+  static void OnAlloc( Stats&, size_t )         { }
+  static void OnDeepCopy( Stats&, size_t )      { }
+  static void OnUnshare( Stats& )               { }
+  static void OnUnshareable( Stats& )           { }
+  static void OnGrow( Stats&, size_t )          { }
+  static void OnFree( Stats&, size_t )          { }
+  static void OnRefsRead( Stats& )              { }
+  static void OnMove( Stats& )                  { }
+};
+
+struct CountInstr : NoInstr
+{
+  static void OnCopy( Stats& s )                { s.OnCopy(); }
+  static void OnAlloc( Stats& s, size_t )       { s.OnAlloc(); }
+  static void OnDeepCopy( Stats& s, size_t n )  { s.OnDeepCopy( n ); }
+  static void OnUnshare( Stats& s )             { s.OnUnshare(); }
+  static void OnGrow( Stats& s, size_t n )      { s.OnGrow( n ); }
+  static void OnRefsRead( Stats& s )            { s.OnRefsRead(); }
+  static void OnMove( Stats& s )                { s.OnMove(); }
+};
+
+struct TraceInstr
+{
+  static void OnCopy( Stats& s )                { s.OnCopy();        TraceLog::Record( evCopy, 0 ); }
+  static void OnShare( Stats& )                 {                    TraceLog::Record( evShare, 0 ); }
+  static void OnAlloc( Stats& s, size_t n )     { s.OnAlloc();       TraceLog::Record( evAlloc, n ); }
+  static void OnDeepCopy( Stats& s, size_t n )  { s.OnDeepCopy( n ); TraceLog::Record( evDeepCopy, n ); }
+  static void OnUnshare( Stats& s )             { s.OnUnshare();     TraceLog::Record( evUnshare, 0 ); }
+  static void OnUnshareable( Stats& )           {                    TraceLog::Record( evUnshareable, 0 ); }
+  static void OnGrow( Stats& s, size_t n )      { s.OnGrow( n );     TraceLog::Record( evGrow, n ); }
+  static void OnFree( Stats&, size_t n )        {                    TraceLog::Record( evFree, n ); }
+  static void OnRefsRead( Stats& s )            { s.OnRefsRead(); }
+  static void OnMove( Stats& s )                { s.OnMove(); }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Sampling profiler: SampleInstr looks at roughly one String copy, unshare
+//  or free in Rate() (the gap is randomized around that, so a workload with
+//  a period of its own isn't always caught at the same point), on each
+//  thread. Allocations, deep copies and grows don't count down: each is
+//  sampled along with the copy, unshare or free before it on its thread, so
+//  it's seen at the same rate. A sample is added to its thread's table under
+//  the current call site, which PROFILE_SITE( "name" ) sets for the rest of
+//  the enclosing scope. Sampling an unshare or an allocation also starts a
+//  clock, which the deep copy or grow that finishes the operation stops, for
+//  its latency.
+//
+//  All that an unsampled operation costs is one thread_local countdown, plus
+//  a read of one global for each allocation, deep copy or grow in it, so it
+//  can stay on.
+//  Multiplying a site's samples by Rate() estimates its totals. Read the
+//  tables only once the sampled threads are done.
+
+struct ProfileEntry
+{
+  const char*        site;      // 0 for a free entry
+  int                type;      // TraceEventType
+  long long          samples;
+  long long          bytes;     // sum of the sampled sizes
+  long long          timed;     // samples with a latency
+  unsigned long long ticks;     // __rdtsc ticks over the timed ones
+  unsigned long long maxTicks;
+};
+
+class StringProfiler
+{
+public:
+  enum { nEntries = 256 };      // per thread slot; a power of 2
+
+  struct Table
+  {
+    ProfileEntry entries[nEntries];
+  };
+
+  //  A copy, unshare or free: the one countdown for its operation.
+  static void Hit( TraceEventType type, size_t size )
+  {
+    State& st = GetState();
+    if( --st.countdown <= 0 )
+    {
+      Slow( st, type, size );
+    }
+  }
+
+  //  An allocation, deep copy or grow: goes with the last Hit on its thread,
+  //  so it's only looked at while some thread has a sample open.
+  static void Part( TraceEventType type, size_t size )
+  {
+    if( OpenThreads() != 0 )
+    {
+      PartSlow( type, size );
+    }
+  }
+
+  //  Sets the current thread's call site, and puts the previous one back.
+  class Site
+  {
+  public:
+    explicit Site( const char* name ) : prev_( GetState().site ) { GetState().site = name; }
+   ~Site() { GetState().site = prev_; }
+  private:
+    Site( const Site& );
+    Site& operator=( const Site& );
+    const char* prev_;
+  };
+
+  static long& Rate()
+  {
+    static long rate = 1000;
+    return rate;
+  }
+
+  //  The current thread's innermost PROFILE_SITE, or 0 outside of any.
+  static const char* CurrentSite() { return GetState().site; }
+
+  //  Table for thread slot i, or 0 if that slot hasn't taken a sample.
+  static Table* Get( int i ) { return Tables()[i]; }
+
+  static void Reset()
+  {
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      if( Tables()[i] )
+      {
+        *Tables()[i] = Table();
+      }
+    }
+    //  Only this thread can still have a sample open.
+    OpenThreads() = ( GetState().sampled || GetState().open ) ? 1 : 0;
+  }
+
+private:
+  //  All zeroes to start with, so the thread_local needs no constructor
+  //  (and no is-it-constructed-yet check on every access).
+  struct State
+  {
+    long               countdown; // Hits to go, or 1 while a sample is open
+    long               gap;       //  and then the Hits to go are kept here
+    unsigned long      seed;
+    const char*        site;      // 0 until a PROFILE_SITE
+    bool               sampled;   // the last Hit was sampled: record its Parts
+    int                open;      // 1 + the unshare or alloc being timed, or 0
+    const char*        openSite;
+    unsigned long long openTsc;
+  };
+
+  static State& GetState()
+  {
+    static thread_local State st;
+    return st;
+  }
+
+  //  Threads with a sample open, so Part can skip the thread_local.
+  static volatile long& OpenThreads()
+  {
+    static volatile long n;
+    return n;
+  }
+
+  static Table** Tables()
+  {
+    static Table* tables[ThreadSlot::nMaxThreads];
+    return tables;
+  }
+
+  static ProfileEntry& Entry( const char* site, int type )
+  {
+    if( !site )
+    {
+      site = "(no site)";
+    }
+    Table*& t = Tables()[ ThreadSlot::Get() ];
+    if( !t )
+    {
+      TscClock::Start();
+      t = new Table();
+    }
+    size_t h = ( reinterpret_cast<size_t>( site ) >> 3 ) * 31 + type;
+    for( size_t k = 0; k < nEntries; ++k )
+    {
+      ProfileEntry& e = t->entries[ ( h + k ) & (nEntries-1) ];
+      if( e.site == site && e.type == type )
+      {
+        return e;
+      }
+      if( !e.site )
+      {
+        e.site = site;
+        e.type = type;
+        return e;
+      }
+    }
+    return t->entries[ h & (nEntries-1) ];  // full: lump it in with another
+  }
+
+  __declspec(noinline) static void Slow( State& st, TraceEventType type, size_t size )
+  {
+    bool wasOpen = st.sampled || st.open;
+    if( st.open )
+    {
+      Close( st, type );
+    }
+    st.sampled = false;
+    if( !wasOpen || --st.gap <= 0 )
+    {
+      Sample( st, type, size );
+    }
+    Settle( st, wasOpen );
+  }
+
+  __declspec(noinline) static void PartSlow( TraceEventType type, size_t size )
+  {
+    State& st = GetState();
+    if( !st.sampled && !st.open )
+    {
+      return;       // another thread's sample
+    }
+    if( st.open )
+    {
+      Close( st, type );
+    }
+    if( st.sampled )
+    {
+      Record( st, type, size );
+      if( type == evAlloc && st.open != 1+evUnshare )
+      {
+        Open( st, type );
+      }
+    }
+    Settle( st, true );
+  }
+
+  static void Sample( State& st, TraceEventType type, size_t size )
+  {
+    if( !st.seed )
+    {
+      st.seed = 2463534242UL;
+    }
+    st.seed ^= st.seed << 13;   // xorshift, for a gap in [Rate()/2, 3*Rate()/2)
+    st.seed ^= st.seed >> 17;
+    st.seed ^= st.seed << 5;
+    st.seed &= 0xFFFFFFFFUL;
+    st.gap = Rate() / 2 + static_cast<long>( st.seed % static_cast<unsigned long>( max( Rate(), 1L ) ) );
+
+    Record( st, type, size );
+    if( type == evUnshare )
+    {
+      Open( st, type );
+    }
+    st.sampled = true;
+  }
+
+  static void Record( State& st, TraceEventType type, size_t size )
+  {
+    ProfileEntry& e = Entry( st.site, type );
+    ++e.samples;
+    e.bytes += size;
+  }
+
+  static void Open( State& st, TraceEventType type )
+  {
+    st.open     = 1 + type;
+    st.openSite = st.site;
+    st.openTsc  = __rdtsc();
+  }
+
+  //  While a sample is open every Hit comes through Slow, and OpenThreads()
+  //  sends this thread's Parts to PartSlow.
+  static void Settle( State& st, bool wasOpen )
+  {
+    bool isOpen = st.sampled || st.open;
+    if( isOpen != wasOpen )
+    {
+      InterlockedExchangeAdd( &OpenThreads(), isOpen ? 1 : -1 );
+    }
+    st.countdown = isOpen ? 1 : st.gap;
+  }
+
+  //  An unshare ends with its deep copy and an allocation with the grow that
+  //  fills it; the allocation inside an unshare is part of the unshare.
+  //  Anything else means the open operation didn't need finishing (say, the
+  //  first allocation of an empty string), so it's dropped untimed.
+  static void Close( State& st, TraceEventType type )
+  {
+    if( ( st.open == 1+evUnshare && type == evDeepCopy ) || ( st.open == 1+evAlloc && type == evGrow ) )
+    {
+      unsigned long long ticks = __rdtsc() - st.openTsc;
+      ProfileEntry& e = Entry( st.openSite, st.open-1 );
+      ++e.timed;
+      e.ticks   += ticks;
+      e.maxTicks = max( e.maxTicks, ticks );
+    }
+    else if( st.open == 1+evUnshare && type == evAlloc )
+    {
+      return;
+    }
+    st.open = 0;
+  }
+};
+
+#define PROFILE_SITE( name ) StringProfiler::Site profileSite_( name )
+
+struct SampleInstr
+{
+  static void OnCopy( Stats& )                  { StringProfiler::Hit( evCopy, 0 ); }
+  static void OnShare( Stats& )                 { }
+  static void OnAlloc( Stats&, size_t n )       { StringProfiler::Part( evAlloc, n ); }
+  static void OnDeepCopy( Stats&, size_t n )    { StringProfiler::Part( evDeepCopy, n ); }
+  static void OnUnshare( Stats& )               { StringProfiler::Hit( evUnshare, 0 ); }
+  static void OnUnshareable( Stats& )           { }
+  static void OnGrow( Stats&, size_t n )        { StringProfiler::Part( evGrow, n ); }
+  static void OnFree( Stats&, size_t n )        { StringProfiler::Hit( evFree, n ); }
+  static void OnRefsRead( Stats& )              { }
+  static void OnMove( Stats& )                  { }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Copy usefulness: what every copy turned out to be good for, per
+//  PROFILE_SITE. Unlike StringProfiler this sees every copy, not a sample,
+//  and it needs to follow each one until it's destroyed, so it isn't a
+//  policy; Tracked<S> in test.cpp wraps a String to report here. A copy that
+//  was never written to was a wasted deep copy that COW would have shared. A
+//  copy whose source was then destroyed or cleared without being touched
+//  again could have been a move. Tables are per thread slot, as in
+//  StringProfiler.
+
+struct UsefulnessEntry
+{
+  const char* site;             // 0 for a free entry
+  long long   copies;
+  long long   mutated;
+  long long   bytes;            // deep-copied by all the copies
+  long long   wastedBytes;      //  ...by the ones never written to
+  long long   movable;
+  long long   movableBytes;
+};
+
+class CopyUsefulness
+{
+public:
+  enum { nEntries = 64 };       // per thread slot; a power of 2
+
+  struct Table
+  {
+    UsefulnessEntry entries[nEntries];
+  };
+
+  //  A copy of bytes chars made at site has just been destroyed (or
+  //  cleared).
+  static void Copy( const char* site, size_t bytes, bool bMutated )
+  {
+    UsefulnessEntry& e = Entry( site );
+    ++e.copies;
+    e.bytes += bytes;
+    if( bMutated )
+    {
+      ++e.mutated;
+    }
+    else
+    {
+      e.wastedBytes += bytes;
+    }
+  }
+
+  //  The source of a copy made at site is gone, untouched since.
+  static void Movable( const char* site, size_t bytes )
+  {
+    UsefulnessEntry& e = Entry( site );
+    ++e.movable;
+    e.movableBytes += bytes;
+  }
+
+  //  Table for thread slot i, or 0 if that slot hasn't seen a copy.
+  static Table* Get( int i ) { return Tables()[i]; }
+
+  static void Reset()
+  {
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      if( Tables()[i] )
+      {
+        *Tables()[i] = Table();
+      }
+    }
+  }
+
+private:
+  static Table** Tables()
+  {
+    static Table* tables[ThreadSlot::nMaxThreads];
+    return tables;
+  }
+
+  static UsefulnessEntry& Entry( const char* site )
+  {
+    if( !site )
+    {
+      site = "(no site)";
+    }
+    Table*& t = Tables()[ ThreadSlot::Get() ];
+    if( !t )
+    {
+      t = new Table();
+    }
+    size_t h = reinterpret_cast<size_t>( site ) >> 3;
+    for( size_t k = 0; k < nEntries; ++k )
+    {
+      UsefulnessEntry& e = t->entries[ ( h + k ) & (nEntries-1) ];
+      if( e.site == site || !e.site )
+      {
+        e.site = site;
+        return e;
+      }
+    }
+    return t->entries[ h & (nEntries-1) ];  // full: lump it in with another
+  }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Live statistics, published in a named shared-memory segment so that
+//  another process ("TestCowStrings -monitor") can watch a long run as it
+//  goes. The threads doing the measured work only ever add to their own
+//  per-thread op counts (AddOps). A publisher thread adds those up every
+//  nPeriodMs and writes them, with the Stats of the String type being run,
+//  into the segment. Begin, called by the harness when it starts a run,
+//  writes the run's names there too. Both write under the segment's SeqCount,
+//  and readers retry, so nobody ever waits on a reader.
+
+struct LiveStatsBlock
+{
+  SeqCount  seq;
+  long      pid;
+  long      done;             // set once the benchmark has finished
+  long      publishes;        // how many times the publisher has written
+  char      scenario[48];
+  char      implementation[48];
+  long      threads;
+  long long ops;              // in the current run
+  double    opsPerSec;        // over the last period
+  long long elapsedMs;        // since the current run began
+  long long copies;           // from the String type's Stats, so these stay
+  long long allocs;           //  at 0 for uninstrumented ones
+};
+
+class LiveStats
+{
+public:
+  enum { nPeriodMs = 250 };
+
+#ifdef _WIN32
+  static const wchar_t* SegmentName() { return L"Local\\TestCowStringsLiveStats"; }
+#else
+  static const char*    SegmentName() { return "/TestCowStringsLiveStats"; }
+#endif
+
+  static void AddOps( long n )
+  {
+    Ops()[ ThreadSlot::Get() ].n += n;
+  }
+
+  //  Creates the segment and starts the publisher; false if there's no
+  //  segment to publish to.
+  static bool Start()
+  {
+    void* p = MapSegment( true );
+    if( !p )
+    {
+      return false;
+    }
+    Block() = new (p) LiveStatsBlock();
+#ifdef _WIN32
+    Block()->pid = static_cast<long>( GetCurrentProcessId() );
+#else
+    Block()->pid = static_cast<long>( getpid() );
+#endif
+    GetPublisher().thread = new Thread<Publisher>( GetPublisher() );
+    return true;
+  }
+
+  //  Stops the publisher, after a last update that says we're done. The
+  //  segment is left mapped, for any monitor that's still reading it. A
+  //  POSIX segment outlives the process unless it's unlinked, which only
+  //  takes the name away, as the last handle closing does on Win32.
+  static void Stop()
+  {
+    Publisher& pub = GetPublisher();
+    if( pub.thread )
+    {
+      pub.stop = 1;
+      delete pub.thread;
+      pub.thread = 0;
+      Publish( true );
+#ifndef _WIN32
+      shm_unlink( SegmentName() );
+#endif
+    }
+  }
+
+  static void Begin( const char* scenario, const char* implementation, long threads, const Stats* stats )
+  {
+    LiveStatsBlock* b = Block();
+    if( !b )
+    {
+      return;
+    }
+    b->seq.WriteBegin();
+    Copy( b->scenario, scenario, sizeof(b->scenario) );
+    Copy( b->implementation, implementation, sizeof(b->implementation) );
+    b->threads = threads;
+    Run()      = RunInfo( TotalOps(), Timer::Ticks(), stats );
+    Last()     = Run().start;
+    b->ops     = 0;
+    b->opsPerSec = 0;
+    b->elapsedMs = 0;
+    b->copies  = 0;
+    b->allocs  = 0;
+    b->seq.WriteEnd();
+  }
+
+  //  Reader side: a consistent snapshot of another process's segment.
+  static bool Read( LiveStatsBlock& snapshot )
+  {
+    static const LiveStatsBlock* b = 0;
+    if( !b )
+    {
+      b = static_cast<const LiveStatsBlock*>( MapSegment( false ) );
+      if( !b )
+      {
+        return false;
+      }
+    }
+    for( ;; )
+    {
+      long s = b->seq.ReadBegin();
+      memcpy( &snapshot, b, sizeof(snapshot) );
+      if( !b->seq.ReadRetry( s ) )
+      {
+        return true;
+      }
+    }
+  }
+
+private:
+  struct alignas(64) OpCount
+  {
+    volatile long long n;
+  };
+
+  //  The segment, created to write or opened to read; 0 if that failed.
+  static void* MapSegment( bool bCreate )
+  {
+#ifdef _WIN32
+    HANDLE h = bCreate
+      ? CreateFileMapping( INVALID_HANDLE_VALUE, 0, PAGE_READWRITE, 0, sizeof(LiveStatsBlock), SegmentName() )
+      : OpenFileMapping( FILE_MAP_READ, FALSE, SegmentName() );
+    return h ? MapViewOfFile( h, bCreate ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, sizeof(LiveStatsBlock) ) : 0;
+#else
+    int fd = bCreate
+      ? shm_open( SegmentName(), O_RDWR | O_CREAT, 0600 )
+      : shm_open( SegmentName(), O_RDONLY, 0 );
+    if( fd < 0 )
+    {
+      return 0;
+    }
+    void* p = 0;
+    if( !bCreate || ftruncate( fd, sizeof(LiveStatsBlock) ) == 0 )
+    {
+      p = mmap( 0, sizeof(LiveStatsBlock), bCreate ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+    }
+    close( fd );
+    return p == MAP_FAILED ? 0 : p;
+#endif
+  }
+
+  struct RunInfo
+  {
+    RunInfo( long long ops0 = 0, long long start = 0, const Stats* stats = 0 )
+      : ops0( ops0 ), start( start ), stats( stats ) { }
+    long long    ops0;        // TotalOps() when the run began
+    long long    start;       // Timer::Ticks() when it began
+    const Stats* stats;
+  };
+
+  struct Publisher
+  {
+    Publisher() : thread( 0 ), stop( 0 ) { }
+    void Run()
+    {
+      while( !stop )
+      {
+        Sleep( nPeriodMs );
+        Publish( false );
+      }
+    }
+    Thread<Publisher>* thread;
+    volatile long      stop;
+  };
+
+  static void Publish( bool done )
+  {
+    LiveStatsBlock* b = Block();
+    b->seq.WriteBegin();
+    const RunInfo& run = Run();
+    long long now  = Timer::Ticks();
+    long long ops  = TotalOps() - run.ops0;
+    long long prev = b->ops;
+    double    ms   = ( now - Last() ) * Timer::NsPerTick() / 1e6;
+    b->ops       = ops;
+    b->opsPerSec = ms > 0 ? ( ops - prev ) * 1000.0 / ms : 0.0;
+    b->elapsedMs = run.start ? static_cast<long long>( ( now - run.start ) * Timer::NsPerTick() / 1e6 ) : 0;
+    if( run.stats )
+    {
+      Counts c  = run.stats->Total();
+      b->copies = c.copies;
+      b->allocs = c.allocs;
+    }
+    b->done = done;
+    ++b->publishes;
+    Last() = now;
+    b->seq.WriteEnd();
+  }
+
+  static long long TotalOps()
+  {
+    long long t = 0;
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      t += Ops()[i].n;
+    }
+    return t;
+  }
+
+  static void Copy( char* dst, const char* src, size_t n )
+  {
+    size_t len = min( strlen( src ), n-1 );
+    memcpy( dst, src, len );
+    dst[len] = 0;
+  }
+
+  static OpCount*        Ops()          { static OpCount ops[ThreadSlot::nMaxThreads]; return ops; }
+  static LiveStatsBlock*& Block()       { static LiveStatsBlock* b; return b; }
+  static Publisher&      GetPublisher() { static Publisher pub; return pub; }
+  static RunInfo&        Run()          { static RunInfo run; return run; }
+  static long long&      Last()         { static long long last; return last; }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Live heap bytes and their peak, for the auto-tuner's memory runs: while
+//  Counting() is set, whatever allocates in a TEST_TUNE build (FastArena's
+//  slots below, and the operator new that test.cpp replaces, which also
+//  gets FastArena's overflow) Adds and Subs the bytes it hands out. Other
+//  builds keep it out of FastArena. Single-threaded use only.
+
+class HeapCount
+{
+public:
+  static void Start()           { Live() = Peak() = 0; Counting() = true; }
+  static void Stop()            { Counting() = false; }
+
+  static void Add( size_t n )
+  {
+    if( Counting() )
+    {
+      Live() += n;
+      Peak()  = max( Peak(), Live() );
+    }
+  }
+
+  static void Sub( size_t n )
+  {
+    if( Counting() )
+    {
+      Live() -= n;
+    }
+  }
+
+  static long long& Peak()      { static long long peak; return peak; }
+
+private:
+  static bool&      Counting()  { static bool counting; return counting; }
+  static long long& Live()      { static long long live; return live; }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  Freed buffers kept per thread for the next allocation of the same capacity
+//  class (16, 32, 64, ... bytes) instead of going back to the heap: a string
+//  that is cleared and refilled, or copied and destroyed, keeps asking for the
+//  same sizes. Each class keeps at most nKept buffers; past that, and above the
+//  largest class, it's plain new[] and delete[]. Free takes the size that was
+//  asked for, so there's no header. A buffer freed on another thread joins
+//  that thread's cache. The caches are per ThreadSlot, so a new thread takes
+//  over the cache of one that has exited; threads past nMaxThreads-1, which
+//  share the last slot, bypass the cache.
+
+struct RecycleCounts
+{
+  long long hits;         // Allocate handed out a cached buffer
+  long long misses;       //  or called new[]
+  long long kept;         // Free cached the buffer
+  long long released;     //  or called delete[]
+};
+
+class RecycleCache
+{
+public:
+  enum { nClasses = 12, nKept = 8 };  // classes of 16 bytes to 32KB
+
+  static char* Allocate( size_t n )
+  {
+    int    k = Class( n );
+    Cache* c = Local();
+    if( k == nClasses )
+    {
+      return new char[ n ];
+    }
+    if( !c )
+    {
+      //  The whole class, since another thread's Free may keep it.
+      return new char[ ClassSize( k ) ];
+    }
+    if( c->n[k] )
+    {
+      ++c->counts.hits;
+      return c->bufs[k][ --c->n[k] ];
+    }
+    ++c->counts.misses;
+    return new char[ ClassSize( k ) ];
+  }
+
+  static void Free( char* p, size_t n )
+  {
+    if( !p )
+    {
+      return;
+    }
+    int    k = Class( n );
+    Cache* c = Local();
+    if( c && k < nClasses && c->n[k] < nKept )
+    {
+      ++c->counts.kept;
+      c->bufs[k][ c->n[k]++ ] = p;
+      return;
+    }
+    if( c )
+    {
+      ++c->counts.released;
+    }
+    delete[] p;
+  }
+
+  //  Like Stats::Total, meant for when the threads being counted are done.
+  static RecycleCounts Total()
+  {
+    RecycleCounts t = RecycleCounts();
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      if( const Cache* c = Caches()[i] )
+      {
+        t.hits     += c->counts.hits;
+        t.misses   += c->counts.misses;
+        t.kept     += c->counts.kept;
+        t.released += c->counts.released;
+      }
+    }
+    return t;
+  }
+
+  //  Gives the calling thread's cached buffers back to the heap.
+  static void Drain()
+  {
+    if( Cache* c = Local() )
+    {
+      for( int k = 0; k < nClasses; ++k )
+      {
+        while( c->n[k] )
+        {
+          delete[] c->bufs[k][ --c->n[k] ];
+        }
+      }
+    }
+  }
+
+  //  The counts only; cached buffers stay cached.
+  static void Reset()
+  {
+    for( int i = 0; i < ThreadSlot::nMaxThreads; ++i )
+    {
+      if( Cache* c = Caches()[i] )
+      {
+        c->counts = RecycleCounts();
+      }
+    }
+  }
+
+private:
+  struct Cache
+  {
+    char*         bufs[nClasses][nKept];
+    int           n[nClasses];
+    RecycleCounts counts;
+  };
+
+  static size_t ClassSize( int k ) { return static_cast<size_t>(16) << k; }
+
+  static int Class( size_t n )
+  {
+    int k = 0;
+    for( size_t m = ( n - 1 ) >> 4; n && m; m >>= 1 )
+    {
+      ++k;
+    }
+    return min( k, static_cast<int>(nClasses) );
+  }
+
+  static Cache* Local()
+  {
+    int slot = ThreadSlot::Get();
+    if( slot == ThreadSlot::nMaxThreads-1 )
+    {
+      return 0;
+    }
+    Cache*& c = Caches()[slot];
+    if( !c )
+    {
+      c = new Cache();
+    }
+    return c;
+  }
+
+  static Cache** Caches() { static Cache* caches[ThreadSlot::nMaxThreads]; return caches; }
+};
+
+
+//------------------------------------------------------------------------------
+//
+//  A (very) simple fixed-length allocator, with the heap behind it for when
+//  all of its slots are taken.
+
+//#define FA_REPORT      1
+//#define FA_DEBUG       1
+#define FA_THREAD_SAFE 1
+
+class FastArena
+{
+public:
+  FastArena( const char* name = "", size_t n = 3000 )
+    : n_( n ? nAlign*((n-1)/nAlign+1) : nAlign ) // a multiple of nAlign
+    , buf_( new char[(n_+nHeader)*size] )
+#ifdef FA_REPORT
+    , current_(0)
+    , highest_(0)
+    , totalops_(0)
+    , name_( name )
+#endif
+  {
+    UNREFERENCED_PARAMETER(name);
+    
+    for( char* p = buf_; p < buf_ + (n_+nHeader)*size; p += (n_+nHeader) )
+    {
+        *((long*)p) = 0;
+    }
+  }
+
+  ~FastArena()
+  {
+#ifdef FA_REPORT
+    cout << "FastArena " << setw(Ass0) << name_
+         << ": current_=" << current_
+         << ", highest_=" << highest_
+         << ", totalops_=" << totalops_ << "\n";
+#endif
+    delete[] buf_;
+    buf_ = 0;
+  }
+
+  void* Allocate( size_t n )
+  {
+    if( n > n_ )
+    {
+#ifdef FA_DEBUG
+      cout << "Bad Allocate: size " << n << ", expected at most " << n_ << "\n" << flush;
+#endif
+      throw bad_alloc();    // ensure we're not getting surprises
+    }
+
+    //  With several threads allocating at once, a free slot has to be claimed
+    //  atomically (0 -> 1), or two threads could both see it free and take it.
+    //  Occupied slots are passed over with a plain read, so the scan only
+    //  locks the cache line of a slot that looks free.
+    char* p = buf_;
+#ifdef FA_THREAD_SAFE
+    while( p < (buf_ + (n_+nHeader)*size)
+        && ( *(volatile long*)p != 0
+          || IntAtomicCompareExchange( *(long*)p, 1L, 0L ) != 0 ) )
+#else
+    while( p < (buf_ + (n_+nHeader)*size) && *((long*)p) != 0 )
+#endif
+    {
+      p += (n_+nHeader);
+    }
+
+    if( p >= (buf_ + (n_+nHeader)*size) )
+    {
+#ifdef FA_DEBUG
+      cout << "Allocate: exhausted, current_=" << current_ << ", using the heap\n" << flush;
+#endif
+      return ::operator new( n_ );  // full: more live buffers than slots
+    }
+
+#ifdef FA_REPORT
+    ++totalops_;
+    if( ++current_ > highest_ ) highest_ = current_;
+#endif
+#ifndef FA_THREAD_SAFE
+    *((long*)p) = 1L;
+#endif
+#ifdef TEST_TUNE
+    HeapCount::Add( n_ );
+#endif
+    return p+nHeader;
+  }
+
+  void Deallocate( void* p )
+  {
+    if( p == 0 )            // support "null-pointer, null-operation" semantics
+    {
+      return;
+    }
+
+    if( p < buf_ || p >= buf_ + (n_+nHeader)*size )
+    {
+      ::operator delete( p );   // from the heap, when the arena was full
+      return;
+    }
+
+#ifdef FA_REPORT
+    ++totalops_;
+    --current_;
+#endif
+#ifdef TEST_TUNE
+    HeapCount::Sub( n_ );
+#endif
+#ifdef FA_DEBUG
+    if( *(long*)(((char*)p)-nHeader) != 1 )
+    {
+      cout << "Bad Deallocate: double delete\n" << flush;
+    }
+#endif
+#ifdef FA_THREAD_SAFE
+    IntAtomicDecrement( *(long*)(((char*)p)-nHeader) );
+#else
+    *(long*)(((char*)p)-nHeader) = 0L;
+#endif
+  }
+
+private:
+  static const size_t size;
+
+  //  Each slot is an in-use flag and then n_ bytes. The flag is padded, and
+  //  n_ rounded up, to pointer alignment, so that the pointers in the objects
+  //  kept there (McsLock's tail_, std::mutex's innards) are aligned for the
+  //  interlocked ops on them.
+  enum { nAlign  = alignof(void*) > 4 ? alignof(void*) : 4,
+         nHeader = ( sizeof(long) + nAlign-1 ) / nAlign * nAlign };
+
+  size_t n_;
+  char*  buf_;
+#ifdef FA_REPORT
+  size_t current_;  // # currently in use
+  size_t highest_;  // highest # currently in use
+  size_t totalops_; // total number of allocations/deallocations
+  const char* name_;
+#endif
+};
+
+const size_t FastArena::size = 1024;  // # elements: past that, Allocate
+                                      //  falls back to the heap, e.g. with
+                                      //  8 threads per core on a machine
+                                      //  with 128 or more logical processors
+
+